@@ -21,9 +21,10 @@
 
 use strict;
 
-# The serial device to which the Pico is connected
+# The serial device to which the Pico is connected. Set PICO7219_DEV to
+#  use a different one, such as the host build's pseudo-terminal.
 
-my $device = "/dev/ttyACM0";
+my $device = $ENV{PICO7219_DEV} || "/dev/ttyACM0";
 
 # Bitmap table for the ten digits and the colon character. Each digit is
 #  5x3 pixels, so each array entry is a row, and only the lowest three
@@ -157,8 +158,8 @@ sub draw_digit ($$)
 # Use stty to initialise the serial port in a way that
 #   is appropriate for this utility. It would be more elegant to use the 
 #   Perl serial library, but not every installation has that.
-system ("stty -F /dev/ttyACM0 speed 115200 >& /dev/null");
-system ("stty -F /dev/ttyACM0 crtscts -ignbrk -brkint -icrnl -imaxbel -opost -onlcr -isig -icanon -iexten -echo -echoke -echok");
+system ("stty -F $device speed 115200 >& /dev/null");
+system ("stty -F $device crtscts -ignbrk -brkint -icrnl -imaxbel -opost -onlcr -isig -icanon -iexten -echo -echoke -echok");
 
 open OUT, ">$device" or die;
 open IN, "<$device" or die;
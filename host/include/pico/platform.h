@@ -0,0 +1,17 @@
+/*=========================================================================
+ 
+  Pico7219usb host build
+
+  pico/platform.h
+
+  The parts of the Pico SDK's platform header that the firmware uses,
+  for building it as an ordinary program. See host/stdlib.c.
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#pragma once
+
+// On the Pico this gives the compiler somewhere to put a no-op in busy
+//   loops. There's nothing to do here.
+static inline void tight_loop_contents (void) {}
@@ -0,0 +1,72 @@
+/*=========================================================================
+ 
+  Pico7219usb host build
+
+  pico/stdlib.h
+
+  The parts of the Pico SDK's standard library that the firmware uses,
+  for building it as an ordinary program. Only the functions that the
+  host build of the firmware actually calls are here. They are 
+  implemented in host/stdlib.c. 
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/platform.h"
+
+typedef struct repeating_timer repeating_timer_t;
+
+/** The function called each time a repeating timer fires. Returning 
+    false stops the timer. */
+typedef bool (*repeating_timer_callback_t) (repeating_timer_t *rt);
+
+/** A repeating timer. In the host build, each one has its own thread,
+    in which the callback runs -- the nearest thing to an interrupt. */
+struct repeating_timer
+  {
+  int64_t delay_us;
+  repeating_timer_callback_t callback;
+  void *user_data;
+  void *thread; // Host only
+  };
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Set up the serial connection to the host. By default this is a 
+    pseudo-terminal; see host/stdlib.c. */
+extern bool stdio_init_all (void);
+
+/** Host only: read whatever has arrived from the host, up to len bytes,
+    in one go. If nothing has, wait at most us microseconds for it.
+    Returns the number of bytes read, which may be zero. This stands in
+    for TinyUSB's tud_cdc_read(). */
+extern int host_read (uint8_t *buf, int len, uint32_t us);
+
+/** Time in microseconds since some fixed point. */
+extern uint64_t time_us_64 (void);
+extern uint32_t time_us_32 (void);
+
+extern void sleep_ms (uint32_t ms);
+extern void sleep_us (uint64_t us);
+
+/** Call callback every delay_us microseconds, until it returns false or
+    the timer is cancelled. If delay_us is negative, the period is 
+    measured from the start of one call to the start of the next; 
+    otherwise from the end of one call. Returns false if the timer
+    can't be started. */
+extern bool add_repeating_timer_us (int64_t delay_us, 
+    repeating_timer_callback_t callback, void *user_data, 
+    repeating_timer_t *out);
+
+/** Stop a repeating timer. Returns false if it wasn't running. */
+extern bool cancel_repeating_timer (repeating_timer_t *timer);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,237 @@
+/*=========================================================================
+ 
+  Pico7219usb host build
+
+  stdlib.c
+
+  A stand-in for the parts of the Pico SDK that the firmware needs, so
+  it can run as an ordinary Linux program. The firmware's serial 
+  connection is a pseudo-terminal, whose name is printed when the 
+  program starts, so host programs can talk to it exactly as they 
+  would talk to /dev/ttyACM0. The display is a simulated MAX7219 chain
+  (see pico7219_backend.h), which prints what it's sent on stderr.
+
+  Two environment variables change the way the serial connection works:
+
+  PICO7219_PTY_LINK -- if set, a symbolic link to the pseudo-terminal
+    is created with this name, so host programs can be given a fixed
+    device name. It's removed when the program exits.
+
+  PICO7219_STDIO -- if set, stdin and stdout are used instead of a
+    pseudo-terminal. The program exits shortly after the end of the
+    input, which makes it easy to drive from a script. 
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+
+// How long to carry on running after the end of the input, in stdio
+//  mode, so that commands that are still being carried out can finish
+#define HOST_EOF_LINGER_US 1000000
+
+// The file descriptor that input from the host arrives on
+static int in_fd = 0;
+
+// TRUE in stdio mode, once the input has ended, and the time it did 
+static bool in_eof = false;
+static uint64_t eof_time = 0;
+
+// The name of the symbolic link to the pseudo-terminal, if there is one
+static const char *pty_link = NULL;
+
+//
+// host_remove_link
+//
+static void host_remove_link (void)
+  {
+  if (pty_link) unlink (pty_link);
+  }
+
+//
+// host_signal
+//
+// Exit normally on SIGINT and SIGTERM, so the link is removed
+//
+static void host_signal (int sig)
+  {
+  (void)sig;
+  exit (0);
+  }
+
+//
+// host_open_pty
+//
+// Create the pseudo-terminal, and make it the firmware's stdout. The 
+// slave side is kept open, so the master doesn't see a hang-up when 
+// host programs close it, and is put in raw mode, so commands aren't 
+// echoed back to the host. Returns false on error.
+//
+static bool host_open_pty (void)
+  {
+  int master = posix_openpt (O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt (master) != 0 || unlockpt (master) != 0)
+    {
+    perror ("Can't create pseudo-terminal");
+    return false;
+    }
+  const char *name = ptsname (master);
+  int slave = open (name, O_RDWR | O_NOCTTY);
+  if (slave < 0)
+    {
+    perror (name);
+    return false;
+    }
+  struct termios t;
+  tcgetattr (slave, &t);
+  cfmakeraw (&t);
+  tcsetattr (slave, TCSANOW, &t);
+
+  const char *link = getenv ("PICO7219_PTY_LINK");
+  if (link)
+    {
+    unlink (link);
+    if (symlink (name, link) == 0)
+      {
+      pty_link = link;
+      atexit (host_remove_link);
+      signal (SIGINT, host_signal);
+      signal (SIGTERM, host_signal);
+      }
+    else
+      perror (link);
+    }
+  fprintf (stderr, "Serial port is %s\n", link && pty_link ? link : name);
+
+  in_fd = master;
+  dup2 (master, STDOUT_FILENO);
+  return true;
+  }
+
+/** stdio_init_all() */
+bool stdio_init_all (void)
+  {
+  if (!getenv ("PICO7219_STDIO"))
+    {
+    if (!host_open_pty ()) exit (1);
+    }
+  setvbuf (stdout, NULL, _IOLBF, 0);
+  return true;
+  }
+
+/** host_read() */
+int host_read (uint8_t *buf, int len, uint32_t us)
+  {
+  if (in_eof)
+    {
+    // Nothing more will arrive, but the caller still expects to wait
+    if (time_us_64() - eof_time > HOST_EOF_LINGER_US) exit (0);
+    sleep_us (us);
+    return 0;
+    }
+  struct pollfd p = { in_fd, POLLIN, 0 };
+  struct timespec t = { us / 1000000, (us % 1000000) * 1000 };
+  if (ppoll (&p, 1, &t, NULL) <= 0) return 0;
+  int n = read (in_fd, buf, len);
+  if (n > 0) return n;
+  if (n == 0 || (errno != EINTR && errno != EAGAIN))
+    {
+    in_eof = true;
+    eof_time = time_us_64();
+    }
+  return 0;
+  }
+
+/** time_us_64() */
+uint64_t time_us_64 (void)
+  {
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+  }
+
+/** time_us_32() */
+uint32_t time_us_32 (void)
+  {
+  return (uint32_t)time_us_64();
+  }
+
+/** sleep_us() */
+void sleep_us (uint64_t us)
+  {
+  struct timespec t = { us / 1000000, (us % 1000000) * 1000 };
+  while (nanosleep (&t, &t) != 0 && errno == EINTR);
+  }
+
+/** sleep_ms() */
+void sleep_ms (uint32_t ms)
+  {
+  sleep_us ((uint64_t)ms * 1000);
+  }
+
+//
+// host_timer_thread
+//
+// Run a repeating timer, sleeping until each call is due. The thread
+// is cancelled while it sleeps, by cancel_repeating_timer().
+//
+static void *host_timer_thread (void *arg)
+  {
+  repeating_timer_t *rt = arg;
+  uint64_t period = rt->delay_us < 0 ? -rt->delay_us : rt->delay_us;
+  struct timespec next;
+  clock_gettime (CLOCK_MONOTONIC, &next);
+  do
+    {
+    if (rt->delay_us >= 0) clock_gettime (CLOCK_MONOTONIC, &next);
+    uint64_t ns = next.tv_nsec + period * 1000;
+    next.tv_sec += ns / 1000000000;
+    next.tv_nsec = ns % 1000000000;
+    while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) 
+       == EINTR);
+    } while (rt->callback (rt));
+  return NULL;
+  }
+
+/** add_repeating_timer_us() */
+bool add_repeating_timer_us (int64_t delay_us, 
+       repeating_timer_callback_t callback, void *user_data, 
+       repeating_timer_t *out)
+  {
+  out->delay_us = delay_us;
+  out->callback = callback;
+  out->user_data = user_data;
+  out->thread = malloc (sizeof (pthread_t));
+  if (!out->thread) return false;
+  if (pthread_create (out->thread, NULL, host_timer_thread, out) != 0)
+    {
+    free (out->thread);
+    out->thread = NULL;
+    return false;
+    }
+  return true;
+  }
+
+/** cancel_repeating_timer() */
+bool cancel_repeating_timer (repeating_timer_t *timer)
+  {
+  if (!timer->thread) return false;
+  pthread_t *thread = timer->thread;
+  pthread_cancel (*thread);
+  pthread_join (*thread, NULL);
+  free (thread);
+  timer->thread = NULL;
+  return true;
+  }
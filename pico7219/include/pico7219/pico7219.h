@@ -11,7 +11,8 @@
   have a "flush" argument. If flush is TRUE, then changes are written
   to the hardware immediately. As it may be necessary to write an 
   entire row to change one LED, it's much more efficient to group
-  changes and called flush() at the end.
+  changes and called flush() at the end. A flush only sends real data
+  to the modules whose row registers have changed.
 
   Note the row and column numbers in all functions are zero-based. The
   "bottom-left" corner is (0,0) although, of course, the display modules
@@ -30,6 +31,13 @@
   first set, but content that won't fit can be scrolled into view by
   calling pico7219_scroll repeatedly. 
 
+  The library can also be double-buffered. In that case, LEDs are
+  turned on and off in a "back" buffer, which is not displayed, while
+  flushing and scrolling use the "front" buffer. When the new content
+  is complete, pico7219_commit() swaps the two buffers at the start
+  of the next flush, so a partly-drawn display is never shown, even
+  while it is scrolling.
+
   Copyright (c)2021 Kevin Boone, GPL v3.0
 
   =========================================================================*/
@@ -57,6 +65,21 @@ typedef uint8_t BOOL;
 //  8x8 modules leads to slow updates.
 #define PICO7219_MAX_CHAIN 8
 
+// Maximum length of the virtual chain, in modules. Each module of the
+//  virtual chain takes eight bytes (sixteen, if double-buffered), so
+//  the default of 1024 modules -- 8192 columns -- can take 16kB. It 
+//  can be changed at build time to suit the memory available.
+#ifndef PICO7219_MAX_VCHAIN
+#define PICO7219_MAX_VCHAIN 1024
+#endif
+
+// Set to 0 to stop the library keeping counts and timings of its work 
+//  (see pico7219_get_stats()), which costs a little time in every flush.
+//  This is the same default as the PICO7219_STATS option in the build.
+#ifndef PICO7219_STATS
+#define PICO7219_STATS 1
+#endif
+
 // Number of LEDs in each row of column. This is a feature of the
 //   MAX7219, and can't usefully be changed
 #define PICO7219_ROWS 8
@@ -71,6 +94,49 @@ enum PicoSpiNum
   };
 
 struct Pico7219;
+struct Pico7219Backend;
+
+/** A record of how long an operation takes, in microseconds */
+struct Pico7219Timer
+  {
+  uint32_t count; // Number of times the operation has been timed
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t total_us;
+  };
+
+/** Counts of the library's work, since the instance was created or
+    pico7219_reset_stats() was called. These are only kept if the library
+    is built with PICO7219_STATS set to 1; otherwise they stay at zero. */
+struct Pico7219Stats
+  {
+  uint32_t flushes; // Number of flushes, synchronous or not
+  uint32_t rows_written; // Number of rows sent to the display chain
+  uint32_t spi_bytes; // Number of bytes sent to the display chain
+  // Time from the start of each flush until it has been sent 
+  struct Pico7219Timer flush_time;
+  };
+
+/** Add a time to a Pico7219Timer */
+static inline void pico7219_timer_add (struct Pico7219Timer *t, uint32_t us)
+  {
+  if (t->count == 0 || us < t->min_us) t->min_us = us;
+  if (t->count == 0 || us > t->max_us) t->max_us = us;
+  t->total_us += us;
+  t->count++;
+  }
+
+/** Get the average time recorded by a Pico7219Timer */
+static inline uint32_t pico7219_timer_avg (const struct Pico7219Timer *t)
+  {
+  return t->count ? (uint32_t)(t->total_us / t->count) : 0;
+  }
+
+/** The type of function called when an asynchronous flush has finished.
+    On the Pico this is called from the DMA interrupt handler, so it
+    should do as little as possible. */
+typedef void (*Pico7219FlushCallback) (struct Pico7219 *self, 
+                          void *user_data);
 
 #ifdef __cplusplus
 extern "C" { 
@@ -87,6 +153,18 @@ extern struct Pico7219 *pico7219_create (enum PicoSpiNum spi_num,
 			   uint8_t sck, uint8_t cs, uint8_t chain_len,
 			   BOOL reverse_bits);
 
+/** Create the Pico7219 structure, using the given backend to send data
+    to the display chain, and initialize the display. See
+    pico7219_backend.h for the backends. pico7219_create() does the
+    same, using the DMA backend on the Pico, and a simulated chain that
+    prints what it is sent (unless PICO7219_SIM_TRACE is 0) in a host
+    build. The library takes ownership of the backend, and destroys it
+    in pico7219_destroy() -- or at once, if this function fails. Returns
+    NULL if out of memory, or if the backend is NULL. */
+extern struct Pico7219 *pico7219_create_with_backend 
+                           (struct Pico7219Backend *backend, 
+                           uint8_t chain_len, BOOL reverse_bits);
+
 /** Clean up the library. If "deinit" is TRUE, the corresponding SPI
     channel in the Pico is deinitialized. In either case, set the 
     display hardware to the low-power standby mode. */
@@ -100,23 +178,54 @@ extern void             pico7219_destroy (struct Pico7219 *self, BOOL deinit);
     MSB, dependending on whether the object was created with 
     bit-reverse mode or not. This is a low-level function, intended
     for clients for which the build-in set_output() and clear_output()
-    methods are not fast enough. It does not change the internal state
-    of the library at all. */
-extern void             pico7219_set_row_bits (const struct Pico7219 *self, 
+    methods are not fast enough. It writes every module, whether it
+    has changed or not. It does not change the LED states held by the 
+    library, but it does record what it wrote to the hardware, so that
+    later flushes know which modules need to be rewritten. */
+extern void             pico7219_set_row_bits (struct Pico7219 *self, 
                           uint8_t row, 
 			  const uint8_t bits[PICO7219_MAX_CHAIN]); 
 
-/** Turn on the LED at a particular row and column. If flush is TRUE,
-    changes are written immediately to the hardware. Otherwise they are
-    buffered for a later call to flush(). */
+/** The library keeps a record of what each MAX7219 register holds, 
+    and flushes only send data to the modules whose registers need to
+    change -- the others get a no-op word, and a row in which no module
+    has changed is not sent at all. invalidate() tells the library that
+    the record can't be trusted (perhaps the display has been unplugged),
+    so the next flush rewrites every row of every module. */
+extern void             pico7219_invalidate (struct Pico7219 *self);
+
+/** Turn on the LED at a particular row and column. The column can be
+    anywhere in the virtual chain; LEDs outside it are ignored. If flush
+    is TRUE, changes are written immediately to the hardware. Otherwise 
+    they are buffered for a later call to flush(). */
 extern void             pico7219_switch_on (struct Pico7219 *self, 
-                          uint8_t row, uint8_t col, BOOL flush);
+                          uint8_t row, int col, BOOL flush);
 
-/** Turn off the LED at a particular row and column. If flush is TRUE,
-    changes are written immediately to the hardware. Otherwise they are
-    buffered for a later call to flush(). */
+/** Turn off the LED at a particular row and column. The column can be
+    anywhere in the virtual chain; LEDs outside it are ignored. If flush
+    is TRUE, changes are written immediately to the hardware. Otherwise 
+    they are buffered for a later call to flush(). */
 extern void             pico7219_switch_off (struct Pico7219 *self, 
-                          uint8_t row, uint8_t col, BOOL flush);
+                          uint8_t row, int col, BOOL flush);
+
+/** Turn on (if on is TRUE) or off a run of len LEDs in a row, starting
+    at column col of the virtual chain and going right. Parts of the 
+    run outside the virtual chain are ignored. Whole bytes are set at
+    once, so this is much quicker than setting the LEDs one at a time.
+    If flush is TRUE, changes are written immediately to the hardware. 
+    Otherwise they are buffered for a later call to flush(). */
+extern void pico7219_hline (struct Pico7219 *self, uint8_t row, int col, 
+                          int len, BOOL on, BOOL flush);
+
+/** Turn on (if on is TRUE) or off a rectangle of LEDs, height rows high
+    and width columns wide, whose bottom-left corner is at the given row
+    and column. Parts of it outside the virtual chain are ignored, so 
+    row can be negative. A vertical line is a rectangle one column wide.
+    Each row is set as hline() does. If flush is TRUE, changes are 
+    written immediately to the hardware. Otherwise they are buffered 
+    for a later call to flush(). */
+extern void pico7219_fill_rect (struct Pico7219 *self, int row, int col, 
+                          int height, int width, BOOL on, BOOL flush);
 
 /** Turn off all the LEDs in a row. If flush is TRUE,
     changes are written immediately to the hardware. Otherwise they are
@@ -140,9 +249,73 @@ extern void pico7219_switch_on_row (struct Pico7219 *self, uint8_t row,
     high intensity. */
 extern void pico7219_switch_on_all (struct Pico7219 *self, BOOL flush);
 
-/** Write buffered LED state changes to the hardware. */
+/** Set the states of a run of LEDs in one row of the virtual chain, 
+    a byte (that is, a module) at a time. bits[0] is written to module
+    number "module", bits[1] to the next, and so on, for n bytes. The LSB
+    of each byte is the left-most column of its module, that is, the 
+    bit for column (8 * module) is the LSB of bits[0]. Bytes that fall
+    beyond the end of the virtual chain are ignored. If flush is TRUE,
+    changes are written immediately to the hardware. Otherwise they are
+    buffered for a later call to flush(). */
+extern void pico7219_set_vrow_bytes (struct Pico7219 *self, uint8_t row, 
+                          int module, const uint8_t *bits, int n, BOOL flush);
+
+/** The same as set_vrow_bytes(), except that the bytes are exclusive-
+    ORed with the LED states, so each 1 bit toggles an LED. This is for
+    applying the difference between two frames. Only the row that is 
+    changed is written by the next flush. */
+extern void pico7219_xor_vrow_bytes (struct Pico7219 *self, uint8_t row, 
+                          int module, const uint8_t *bits, int n, BOOL flush);
+
+/** Set the states of n whole columns of LEDs, starting at column col of
+    the virtual chain. Each byte of cols[] is one column, and bit r of
+    it is the state of the LED in row r, so the LSB is the bottom row.
+    This is the layout of most bitmap fonts for LED displays, and of 
+    the columns that image tools export. Columns outside the virtual
+    chain are ignored. The bytes are transposed into the library's 
+    row layout a module at a time, so this is about as quick as 
+    set_vrow_bytes(). If flush is TRUE, changes are written immediately
+    to the hardware. Otherwise they are buffered for a later call to 
+    flush(). */
+extern void pico7219_set_columns (struct Pico7219 *self, int col, 
+                          const uint8_t *cols, int n, BOOL flush);
+
+/** Turn on the LEDs of an 8x8 image, such as a font glyph, with its 
+    left-most column at column col of the virtual chain. bits[] has 
+    one byte for each row, starting at row 0. If msb_first is TRUE,
+    the MSB of each byte is the left-most column, as it is in most font
+    tables; otherwise the LSB is. LEDs that are already on are left on,
+    and parts of the image beyond the end of the virtual chain are 
+    ignored. This is much quicker than turning on the LEDs one at a 
+    time, because each row is written as (at most) two shifted bytes. */
+extern void pico7219_blit (struct Pico7219 *self, int col, 
+                          const uint8_t bits[PICO7219_ROWS], BOOL msb_first, 
+                          BOOL flush);
+
+/** Write buffered LED state changes to the hardware. If a commit is 
+    pending, the front and back buffers are swapped first. */
 extern void pico7219_flush (struct Pico7219 *self);
 
+/** Start writing buffered LED state changes to the hardware, and return
+      without waiting for them to be written. The changed rows are copied
+      into a staging buffer, so the caller is free to make further
+      changes straight away; these will be written by the next flush. 
+      When the last row has been written, callback (if not NULL) is 
+      called with user_data. If a previous async flush is still in 
+      progress, this function waits for it to finish first. So does
+      any other function that writes to the hardware. 
+    On the Pico the transfer is done by DMA. In host builds, or if no
+      DMA channels were available, the flush is done before this function
+      returns, and the callback is called from it. */
+extern void pico7219_flush_async (struct Pico7219 *self, 
+                          Pico7219FlushCallback callback, void *user_data);
+
+/** Returns TRUE if an async flush is still in progress. */
+extern BOOL pico7219_is_busy (const struct Pico7219 *self);
+
+/** Wait for any async flush in progress to finish. */
+extern void pico7219_wait (const struct Pico7219 *self);
+
 /** Set the LED brightness in the range 0-15. Default is 1. Note that
  * there is no "off" setting -- even 0 has some illumination. */
 extern void pico7219_set_intensity (struct Pico7219 *self, uint8_t intensity);
@@ -152,16 +325,68 @@ extern void pico7219_set_intensity (struct Pico7219 *self, uint8_t intensity);
       wrap is TRUE, pixels that are scrolled off the display are redrawn
       on the end (of the virtual chain) and may eventually be scrolled back
       into view.
-    This function is design to be used alone. Writing new data to the module
-      while scrolling will have odd results. Calling flush() will restore
-      the non-scrolled state.
+    With wrap TRUE, the contents of the virtual chain are not changed at
+      all -- the display is a window onto the virtual chain, and scrolling
+      just moves the window one pixel to the right. So the time taken 
+      depends on the length of the physical chain, not the virtual one.
+      Subsequent calls to flush() show the window at its current
+      position; use set_scroll_offset() to put it back at the start.
+    With wrap FALSE, the whole virtual chain is shifted left, and
+      pixels that fall off the start are lost. If the library is 
+      double-buffered, this only affects the front buffer.
     Note that the display will scroll even if the text will fit on the module.
       Don't ask for it if you don't want it. */
 extern void pico7219_scroll (struct Pico7219 *self, BOOL wrap);
 
+/** Scroll the virtual module chain one pixel to the right -- the 
+      opposite of scroll(). With wrap TRUE, the display window moves one
+      pixel to the left, wrapping from the start of the virtual chain to
+      its end. With wrap FALSE, the whole virtual chain is shifted right,
+      and pixels that fall off the end are lost. */
+extern void pico7219_scroll_right (struct Pico7219 *self, BOOL wrap);
+
+/** Set the position, in pixels, of the left-hand edge of the display
+      window within the virtual chain. The value is taken modulo the
+      width of the virtual chain. Changes are not written to the 
+      hardware until the next flush() or scroll(), but every row is
+      marked for writing. */
+extern void pico7219_set_scroll_offset (struct Pico7219 *self, int offset);
+
+/** Get the position of the display window within the virtual chain. */
+extern int pico7219_get_scroll_offset (const struct Pico7219 *self);
+
+/** Scroll the display vertically, by rotating its rows: display row r
+      shows row (r + offset) of the virtual chain, modulo 
+      PICO7219_ROWS, so rows that scroll off the top come back at the
+      bottom. Reducing the offset by one moves the contents up one row.
+      Nothing in the virtual chain changes, so each step costs no more
+      than one flush of every row. As with set_scroll_offset(), the 
+      change is written at the next flush. A commit that doesn't keep
+      the phase sets the offset back to zero. */
+extern void pico7219_set_vscroll_offset (struct Pico7219 *self, int offset);
+
+/** Get the vertical scroll offset. */
+extern int pico7219_get_vscroll_offset (const struct Pico7219 *self);
+
+/** Start a "roll" transition, in which new contents roll in from below
+      and push the current contents up and off the top of the display.
+      What is displayed now is remembered, and is what is displayed 
+      until the first call to roll_step(). Usually the new contents are 
+      then drawn and committed, and roll_step() and a flush are called
+      PICO7219_ROWS times. Each step moves the old contents up one row,
+      and brings one more row of the front buffer into view under them,
+      at a cost of no more than one flush of every row. */
+extern void pico7219_begin_roll (struct Pico7219 *self);
+
+/** Move a roll transition on by one row. The change is written at the 
+      next flush. Returns TRUE if the roll still has further to go, and 
+      FALSE once the new contents are completely displayed, or if no roll
+      was in progress. */
+extern BOOL pico7219_roll_step (struct Pico7219 *self);
+
 /** Set the number of "virtual modules" in the display chain. This can be
-      any length (subject to memory), but it makes little sense to set
-      this smaller than the actual display. The purpose of setting the
+      any length up to PICO7219_MAX_VCHAIN (subject to memory), but it
+      makes little sense to set this smaller than the actual display. The purpose of setting the
       virtual length is to be able to write content that will not fit
       onto the physical display, and then call scroll() to bring it 
       into view. By default, the virtual chain length is the same as
@@ -170,15 +395,70 @@ extern void pico7219_scroll (struct Pico7219 *self, BOOL wrap);
       little memory by setting the virtual chain length to the actual
       chain length. But we're talking bytes here.
 
-      This function will clear all data. It is advisable not to change
-      the change length on a whim.
+      Whatever has already been drawn is kept, except anything on
+      modules that are cut off by shortening the chain. Memory is not 
+      released when the chain is shortened, and is allocated in 
+      increasing steps when it is lengthened, so changing the length 
+      often is cheap. Use reset_virtual_chain() to clear the chain and
+      release memory. If the library is double-buffered, this applies 
+      only to the back buffer.
 */
 extern void pico7219_set_virtual_chain_length (struct Pico7219 *self, 
    int chain_len);
 
-/** Get the current length of the "virtual chain" of modules. */
+/** Set the length of the "virtual chain" as set_virtual_chain_length()
+      does, but clear all data, release any memory that is no longer 
+      needed, and move the display window back to the start of the 
+      virtual chain. If the library is double-buffered, this applies 
+      only to the back buffer, and the display window is not moved 
+      until the buffer is committed. */
+extern void pico7219_reset_virtual_chain (struct Pico7219 *self, 
+   int chain_len);
+
+/** Lengthen the "virtual chain" to chain_len modules, keeping what has 
+      already been drawn. Unlike set_virtual_chain_length(), this doesn't
+      clear anything, or move the display window. Memory is allocated
+      in increasing steps, so that a chain that is lengthened a little
+      at a time is not reallocated every time. If the chain is already
+      at least chain_len modules long, nothing changes. Returns FALSE
+      if there isn't enough memory, or chain_len is more than 
+      PICO7219_MAX_VCHAIN, in which case nothing changes. If
+      the library is double-buffered, this applies only to the back
+      buffer. */
+extern BOOL pico7219_grow_virtual_chain (struct Pico7219 *self, 
+   int chain_len);
+
+/** Get the current length of the "virtual chain" of modules. If the 
+      library is double-buffered, this is the length of the back buffer.*/
 extern int pico7219_get_virtual_chain_length (const struct Pico7219 *self);
 
+/** Turn double-buffering on or off. When it is turned on, the back 
+      buffer starts as a copy of what is displayed. When it is turned
+      off, the library carries on with the contents of the front buffer,
+      and any changes that have not been committed are lost. By default,
+      the library is not double-buffered. */
+extern void pico7219_set_double_buffered (struct Pico7219 *self, BOOL on);
+
+/** Ask for the back buffer to become the front buffer at the start of
+      the next flush() or flush_async() -- which includes the flush that
+      scroll() does. So the swap always happens between two complete
+      frames. After the swap, the new back buffer is made a copy of the
+      new front buffer, so drawing can carry on from what is displayed.
+      If keep_phase is TRUE, the display window stays where it is in 
+      the virtual chain (wrapped, if the new virtual chain is shorter), 
+      so scrolling carries on smoothly. Otherwise, the window goes back
+      to the start. If the library is not double-buffered, the only 
+      effect is on the window position. */
+extern void pico7219_commit (struct Pico7219 *self, BOOL keep_phase);
+
+/** Get the counts and timings of the library's work. See 
+    struct Pico7219Stats. */
+extern void pico7219_get_stats (const struct Pico7219 *self, 
+                          struct Pico7219Stats *stats);
+
+/** Set all the counts and timings back to zero. */
+extern void pico7219_reset_stats (struct Pico7219 *self);
+
 #ifdef __cplusplus
 } 
 #endif
@@ -0,0 +1,117 @@
+/*=========================================================================
+
+  Pico7219
+
+  pico7219_backend.h
+
+  The interface between the Pico7219 library and whatever carries its
+  data to the display chain. The library works out what 16-bit words
+  each row needs, and hands them to a "backend" one transaction -- one
+  period of chip-select being low -- at a time.
+
+  There are three backends:
+
+  The SPI backend writes each transaction using the Pico SDK's blocking
+  SPI functions.
+
+  The DMA backend is the SPI backend, but it can also send a whole
+  frame in the background, by DMA, so the CPU is free while the SPI
+  hardware clocks out the data. Only one DMA backend can be in use at
+  a time.
+
+  The simulator backend doesn't need any hardware. It decodes the data
+  that would have been sent into the registers of a simulated chain of
+  MAX7219s, and counts bytes and transactions, so the library can be
+  checked, and its cost measured, on an ordinary computer. It can also
+  print each transaction as it's sent, which is what the library does
+  by default in a host build.
+
+  Copyright (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include "pico7219/pico7219.h"
+
+// Number of registers in each MAX7219. Register 0 is the no-op
+//   register, 1-8 are the rows, and the rest are control registers.
+#define PICO7219_REGS 16
+
+/** The function a backend calls when a background write has finished.
+    This might be called in interrupt context. */
+typedef void (*Pico7219BackendDone) (void *ctx);
+
+/** The backend "vtable". Each backend embeds one of these at the start
+    of its own data, so a pointer to it is a pointer to the backend. */
+struct Pico7219Backend
+  {
+  /** Send len bytes as a single transaction, and wait until they have
+      been sent. */
+  void (*write) (struct Pico7219Backend *self, const uint8_t *buf,
+          int len);
+  /** Start sending n transactions of len bytes each, in the background.
+      The data for transaction i is at buf + i * stride, and must stay
+      in place until done(ctx) is called. Returns FALSE if the backend
+      can't do this, in which case nothing has been sent. This can be
+      NULL, if the backend never sends in the background. */
+  BOOL (*write_async) (struct Pico7219Backend *self, const uint8_t *buf,
+          int stride, int len, int n, Pico7219BackendDone done, void *ctx);
+  /** Tidy up the backend, and free it. If deinit is TRUE, release any
+      hardware it uses. */
+  void (*destroy) (struct Pico7219Backend *self, BOOL deinit);
+  };
+
+/** Counts of what the simulator backend has been sent. */
+struct Pico7219SimStats
+  {
+  uint32_t transactions; // Number of times chip-select was raised
+  uint32_t bytes; // Number of bytes sent
+  uint32_t register_writes; // Number of words that weren't no-ops
+  };
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if PICO_ON_DEVICE
+/** Create a backend that sends with blocking SPI writes. This
+    initializes the SPI channel and the pins. Returns NULL if out of
+    memory. */
+extern struct Pico7219Backend *pico7219_spi_backend_create
+                          (enum PicoSpiNum spi_num, int32_t baud,
+                          uint8_t mosi, uint8_t sck, uint8_t cs);
+
+/** Create a backend that sends frames by DMA. It needs two DMA 
+    channels, one to send and one to receive. If they aren't both 
+    available, or another DMA backend already exists, this is the same
+    as the SPI backend. Returns NULL if out of memory. */
+extern struct Pico7219Backend *pico7219_dma_backend_create
+                          (enum PicoSpiNum spi_num, int32_t baud,
+                          uint8_t mosi, uint8_t sck, uint8_t cs);
+#endif
+
+/** Create a simulated chain of chain_len MAX7219s. All registers start
+    at zero. If trace is TRUE, every word sent is printed on stderr, 
+    along with the changes of chip-select. Returns NULL if out of memory. */
+extern struct Pico7219Backend *pico7219_sim_backend_create (int chain_len,
+                          uint8_t cs, BOOL trace);
+
+/** Get the value of a register in a module of a simulated chain. Module
+    0 is the one nearest the input. */
+extern uint8_t pico7219_sim_get_register
+                          (const struct Pico7219Backend *self,
+                          int module, int reg);
+
+/** Get the counts of what a simulated chain has been sent. */
+extern void pico7219_sim_get_stats (const struct Pico7219Backend *self,
+                          struct Pico7219SimStats *stats);
+
+/** Set the counts of a simulated chain back to zero. The registers are
+    not changed. */
+extern void pico7219_sim_reset_stats (struct Pico7219Backend *self);
+
+#ifdef __cplusplus
+}
+#endif
+
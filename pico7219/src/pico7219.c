@@ -6,10 +6,15 @@
 
   A low-level driver for chained display modules based on the MAX7219.
   See the corresponding header file for a description of how the 
-  functions are used. If this library is built in "host" mode, the 
-  actual GPIO operations are replaced by printouts of the pins of the
+  functions are used. The data is sent to the display by a "backend" 
+  -- see pico7219_backend.h. If this library is built in "host" mode,
+  the default backend is a simulated display chain that prints the
   operations that would be carried out.
 
+  An asynchronous flush stages the whole frame in a buffer, one run of
+  module words for each row, and hands it to the backend to send in the
+  background, if it can.
+
   Copyright (c)2021 Kevin Boone, GPL v3.0
 
   =========================================================================*/
@@ -17,84 +22,158 @@
 #include <string.h>
 
 #if PICO_ON_DEVICE
-#include "hardware/spi.h"
-#include "hardware/gpio.h"
+#include "pico/platform.h"
 #else
 #include <stdio.h> // For printf(). Don't need this in the Pico build
 #endif
 
 #include "pico7219/pico7219.h"
+#include "pico7219/pico7219_backend.h"
+#if PICO7219_STATS
+#include "pico/stdlib.h" // For time_us_32()
+#endif
+
+// In a host build, whether the simulated display chain prints everything
+//   it is sent (on stderr)
+#ifndef PICO7219_SIM_TRACE
+#define PICO7219_SIM_TRACE 1
+#endif
 
+// Statistics are only gathered if PICO7219_STATS is set
+#if PICO7219_STATS
+#define PICO7219_COUNT(field, n) (self->stats.field += (n))
+#else
+#define PICO7219_COUNT(field, n)
+#endif
+
+#define PICO7219_NOOP_REG 0x00
 #define PICO7219_INTENSITY_REG 0x0A
 #define PICO7219_SHUTDOWN_REG 0x0C
 
+static void pico7219_vrow_to_row (const struct Pico7219 *self, int row,
+        uint8_t bits[PICO7219_MAX_CHAIN]);
+
 // Use a lookup table of reversed bytes, for occasions when we need to
 //   reverse the order of bits in a byte. The table only takes 256
-//   bytes, and we only have to do the initialization once. This is a lot
-//   quicker than doing the bit-reverse math every time we need it.
-static uint8_t pico7219_reverse_bits (uint8_t b);
-uint8_t rev_table[256];
+//   bytes, and is built by the compiler, so it is never written at run
+//   time, and can be read from either core without any locking. This 
+//   is a lot quicker than doing the bit-reverse math every time we 
+//   need it. Each REVn() expands to 2^n entries of the table.
+#define REV2(n) n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define REV4(n) REV2(n), REV2(n + 2 * 16), REV2(n + 1 * 16), REV2(n + 3 * 16)
+#define REV6(n) REV4(n), REV4(n + 2 * 4), REV4(n + 1 * 4), REV4(n + 3 * 4)
+static const uint8_t rev_table[256] = { REV6(0), REV6(2), REV6(1), REV6(3) };
+
+// The LED states of a virtual chain of modules. There are PICO7219_ROWS
+//   rows, each of vcap bytes, of which the first vchain_len are in use.
+//   The bytes beyond vchain_len are always zero, so the chain can be
+//   lengthened, up to vcap, just by changing vchain_len.
+struct Pico7219Buffer
+  {
+  uint8_t *vdata;
+  // Length of the "virtual chain" of modules
+  int vchain_len;
+  // Number of modules allocated for each row 
+  int vcap;
+  };
 
 // An opaque data structure that holds the information relevant to the
 //   library. Users of the library do not see this, or need to. 
 
 struct Pico7219
   {
-  uint8_t spi_num; // 0 or 1
-  uint8_t cs; // Chip select GPIO pin
+  struct Pico7219Backend *backend; // Sends data to the display chain
   uint8_t chain_len; // Number of chained devices
   BOOL reverse_bits; // TRUE is we must reverse output->layout order
-#if PICO_ON_DEVICE
-  spi_inst_t* spi; // The Pico-specific SPI device
-#endif
   // data is an array of bits that represents the states of the 
   //   individual (hardware) bits. They are packed into 8-bit chunks, which is
   //   how the need to be written to the hardware, as well as saving
-  //   space.
+  //   space. This is a shadow of what the row registers in each MAX7219
+  //   actually hold, so a flush need only write the modules whose 
+  //   registers have changed. 
   uint8_t data[PICO7219_ROWS][PICO7219_MAX_CHAIN];
+  BOOL data_valid; // FALSE if data can't be trusted to match the hardware
   uint8_t row_dirty [PICO7219_ROWS]; // TRUE for each row to be flushed
-  uint8_t *vdata;
-  // Length of the "virtual chain" of modules
-  int vchain_len;
+  // When double-buffering, TRUE for each row of the drawing buffer that
+  //   has changed since the last commit. A commit passes these on to 
+  //   row_dirty, rather than making every row dirty.
+  uint8_t draw_dirty [PICO7219_ROWS]; 
+  // There are two buffers of LED states but, unless double-buffering
+  //   is turned on, only buffers[0] is used, and draw and show both 
+  //   point to it. 
+  struct Pico7219Buffer buffers[2];
+  struct Pico7219Buffer *draw; // The buffer that drawing functions change
+  struct Pico7219Buffer *show; // The buffer that is written to the display
+  BOOL commit_pending; // TRUE to swap draw and show at the next flush
+  BOOL commit_keep_phase; // TRUE to keep scroll_offset when swapping
+  // Position, in pixels, of the left-hand edge of the physical display
+  //   within the virtual chain. Wrapped scrolling just moves this
+  //   window, rather than shifting all the bits in vdata.
+  int scroll_offset;
+  // Vertical scrolling rotates the rows: display row r shows row
+  //   (r + vscroll_offset) % PICO7219_ROWS of the virtual chain, so
+  //   no bits have to move at all.
+  int vscroll_offset;
+  // During a roll transition (see pico7219_begin_roll()), roll_old is
+  //   what was displayed when it began, and roll_rows is the number of
+  //   rows of the new contents that have rolled in under it. roll_rows
+  //   is zero when there's no roll in progress.
+  BOOL roll_active;
+  int roll_rows;
+  uint8_t roll_old[PICO7219_ROWS][PICO7219_MAX_CHAIN];
+  // frame holds the SPI bytes for an asynchronous flush -- a run of
+  //   2-byte module words for each row that has to be written. 
+  uint8_t frame[PICO7219_ROWS][2 * PICO7219_MAX_CHAIN];
+  uint8_t frame_rows; // Number of rows staged in frame
+  volatile BOOL busy; // TRUE while an async flush is in progress
+  Pico7219FlushCallback flush_callback;
+  void *flush_user_data;
+  // Counts and timings, which are only kept if PICO7219_STATS is set
+  struct Pico7219Stats stats;
+  uint32_t flush_start; // Time at which the current async flush started
   };
 
-/** Change the state of the chip-select line, allowing a very short
-    time for it to settle. */
-static void pico7219_cs (const struct Pico7219 *self, uint8_t select)
-  {
-#if PICO_ON_DEVICE
-  asm volatile("nop \n nop \n nop");
-  gpio_put (self->cs, select);  
-  asm volatile("nop \n nop \n nop");
-#else
-  printf ("Set GPIO %d = %d\n", self->cs, select);
-#endif
-  }
-
 /** write_word_to_chain() outputs the same 16-bit word as many times
     as there are modules in the chain. This is mostly used for
     initialization -- each module will be initialized with the same
     values, so we must repeat the data output enough times that each
     module gets a copy. */
-static void pico7219_write_word_to_chain (const struct Pico7219 *self, 
+static void pico7219_write_word_to_chain (struct Pico7219 *self, 
         uint8_t hi, uint8_t lo)
   {
-  pico7219_cs (self, 0); 
-#if PICO_ON_DEVICE
-  uint8_t buf[] = {hi, lo};
+  uint8_t buf[2 * PICO7219_MAX_CHAIN];
   int l = self->chain_len;
   for (int i = 0; i < l; i++)
-    spi_write_blocking (self->spi, buf, 2);
-#else
-  (void)hi; (void)lo;
+    {
+    buf[2 * i] = hi;
+    buf[2 * i + 1] = lo;
+    }
+  pico7219_wait (self);
+  self->backend->write (self->backend, buf, 2 * l);
+  PICO7219_COUNT (spi_bytes, 2 * l);
+  }
+
+/** pico7219_wait() */
+void pico7219_wait (const struct Pico7219 *self)
+  {
+  while (self->busy)
+    {
+#if PICO_ON_DEVICE
+    tight_loop_contents();
 #endif
-  pico7219_cs (self, 1); 
+    }
+  }
+
+/** pico7219_is_busy() */
+BOOL pico7219_is_busy (const struct Pico7219 *self)
+  {
+  return self->busy;
   }
 
 /* init() sends the same set of initialization values to all modules
    in the chain. We write zero to all the row buffers, and set
    reasonable values for the control registers. */
-static void pico7219_init (const struct Pico7219 *self)
+static void pico7219_init (struct Pico7219 *self)
   {
   // Rows
   pico7219_write_word_to_chain (self, 0x00, 0x00); 
@@ -112,132 +191,448 @@ static void pico7219_init (const struct Pico7219 *self)
   pico7219_write_word_to_chain (self, 0x0b, 0x07); // scan limit = full 
   pico7219_write_word_to_chain (self, PICO7219_SHUTDOWN_REG, 0x01); // Run 
   pico7219_write_word_to_chain (self, 0x0f, 0x00); // Display test = off 
-  // Initialize the byte-reverse lookup table
-  for (int i = 0; i < 256; i++)
-    rev_table[i] =  pico7219_reverse_bits(i);
+  }
+
+/** Replace a buffer's data with a blank buffer of the given length.
+    At least one module is allocated, even for an empty chain. Returns
+    FALSE if out of memory, in which case the buffer is unchanged. */
+static BOOL pico7219_buffer_alloc (struct Pico7219Buffer *buffer, 
+        int chain_len)
+  {
+  if (chain_len < 0) chain_len = 0;
+  int cap = chain_len > 0 ? chain_len : 1;
+  uint8_t *vdata = malloc (PICO7219_ROWS * cap);
+  if (!vdata) return FALSE;
+  memset (vdata, 0, PICO7219_ROWS * cap);
+  if (buffer->vdata) free (buffer->vdata);
+  buffer->vdata = vdata;
+  buffer->vchain_len = chain_len;
+  buffer->vcap = cap;
+  return TRUE;
+  }
+
+/** Free a buffer's data. */
+static void pico7219_buffer_free (struct Pico7219Buffer *buffer)
+  {
+  if (buffer->vdata) free (buffer->vdata);
+  buffer->vdata = NULL;
+  buffer->vchain_len = 0;
+  buffer->vcap = 0;
+  }
+
+/** Lengthen a buffer to chain_len modules, keeping its contents. If 
+    this needs more memory, the capacity is at least doubled, so that
+    lengthening a chain one module at a time doesn't cost a 
+    reallocation every time, but never beyond PICO7219_MAX_VCHAIN. 
+    Returns FALSE if out of memory, or chain_len is more than 
+    PICO7219_MAX_VCHAIN, in which case the buffer is unchanged. */
+static BOOL pico7219_buffer_grow (struct Pico7219Buffer *buffer, 
+        int chain_len)
+  {
+  if (chain_len <= buffer->vchain_len) return TRUE;
+  if (chain_len > PICO7219_MAX_VCHAIN) return FALSE;
+  if (chain_len > buffer->vcap)
+    {
+    int old_cap = buffer->vcap;
+    int new_cap = 2 * old_cap;
+    if (new_cap < chain_len) new_cap = chain_len;
+    if (new_cap > PICO7219_MAX_VCHAIN) new_cap = PICO7219_MAX_VCHAIN;
+    uint8_t *vdata = realloc (buffer->vdata, PICO7219_ROWS * new_cap);
+    if (!vdata) return FALSE;
+    // Spread the rows out to the new stride, starting from the last 
+    //   row, so that no row is overwritten before it has been moved 
+    for (int row = PICO7219_ROWS - 1; row >= 0; row--)
+      {
+      memmove (vdata + row * new_cap, vdata + row * old_cap, old_cap);
+      memset (vdata + row * new_cap + old_cap, 0, new_cap - old_cap);
+      }
+    buffer->vdata = vdata;
+    buffer->vcap = new_cap;
+    }
+  buffer->vchain_len = chain_len;
+  return TRUE;
+  }
+
+/** Make one buffer a copy of another. The memory of "to" is reused if
+    it is big enough. If it isn't, and there isn't enough memory to 
+    replace it, as much of the chain is copied as will fit, and FALSE
+    is returned. */
+static BOOL pico7219_buffer_copy (struct Pico7219Buffer *to, 
+        const struct Pico7219Buffer *from)
+  {
+  BOOL ok = TRUE;
+  if (!to->vdata || to->vcap < from->vchain_len)
+    ok = pico7219_buffer_alloc (to, from->vchain_len);
+  if (!to->vdata) return FALSE;
+  int len = from->vchain_len;
+  if (len > to->vcap) len = to->vcap;
+  for (int row = 0; row < PICO7219_ROWS; row++)
+    {
+    memcpy (to->vdata + row * to->vcap, from->vdata + row * from->vcap, len);
+    memset (to->vdata + row * to->vcap + len, 0, to->vcap - len);
+    }
+  to->vchain_len = len;
+  return ok;
+  }
+
+/** Shorten a buffer to chain_len modules. The memory is kept, so the
+    buffer can be lengthened again cheaply, but the modules that are
+    cut off are cleared, so they don't come back if it is. */
+static void pico7219_buffer_shrink (struct Pico7219Buffer *buffer, 
+        int chain_len)
+  {
+  if (chain_len >= buffer->vchain_len) return;
+  for (int row = 0; row < PICO7219_ROWS; row++)
+    memset (buffer->vdata + row * buffer->vcap + chain_len, 0, 
+      buffer->vchain_len - chain_len);
+  buffer->vchain_len = chain_len;
+  }
+
+/** Record that a row of the drawing buffer has changed. If it's also
+    the buffer that is shown, the row has to be flushed; otherwise it 
+    has to be flushed after the next commit. row is -1 if every row has
+    changed. */
+static void pico7219_row_changed (struct Pico7219 *self, int row)
+  {
+  uint8_t *dirty = self->draw == self->show ? self->row_dirty 
+    : self->draw_dirty;
+  if (row < 0)
+    memset (dirty, TRUE, PICO7219_ROWS);
+  else
+    dirty[row] = TRUE;
   }
 
 /** pico7219_set_virtual_chain_length() */ 
 void pico7219_set_virtual_chain_length (struct Pico7219 *self, int chain_len)
   {
-  if (self->vdata) free (self->vdata);
-  self->vdata = malloc (PICO7219_ROWS * chain_len);
-  memset (self->vdata, 0, PICO7219_ROWS * chain_len);
-  self->vchain_len = chain_len;
+  if (chain_len > self->draw->vchain_len)
+    pico7219_buffer_grow (self->draw, chain_len);
+  else if (chain_len < self->draw->vchain_len)
+    {
+    pico7219_buffer_shrink (self->draw, chain_len);
+    pico7219_row_changed (self, -1);
+    }
+  // Keep the display window inside the (possibly shorter) chain
+  if (self->draw == self->show)
+    pico7219_set_scroll_offset (self, self->scroll_offset);
+  }
+
+/** pico7219_reset_virtual_chain() */ 
+void pico7219_reset_virtual_chain (struct Pico7219 *self, int chain_len)
+  {
+  if (chain_len > PICO7219_MAX_VCHAIN) chain_len = PICO7219_MAX_VCHAIN;
+  if (chain_len < 0) chain_len = 0;
+  struct Pico7219Buffer *b = self->draw;
+  if (!pico7219_buffer_alloc (b, chain_len) && b->vdata)
+    {
+    // Out of memory -- keep the old buffer, cleared and shortened
+    memset (b->vdata, 0, PICO7219_ROWS * b->vcap);
+    b->vchain_len = chain_len < b->vcap ? chain_len : b->vcap;
+    }
+  pico7219_row_changed (self, -1);
+  if (self->draw == self->show)
+    self->scroll_offset = 0;
+  }
+
+/** pico7219_set_scroll_offset() */ 
+void pico7219_set_scroll_offset (struct Pico7219 *self, int offset)
+  {
+  int width = PICO7219_COLS * self->show->vchain_len;
+  // An empty chain has nowhere to scroll to
+  if (width == 0) 
+    offset = 0;
+  else
+    {
+    offset %= width;
+    if (offset < 0) offset += width;
+    }
+  self->scroll_offset = offset;
+  // Moving the window changes every row
+  memset (self->row_dirty, TRUE, sizeof (self->row_dirty));
+  }
+
+/** pico7219_get_scroll_offset() */ 
+int pico7219_get_scroll_offset (const struct Pico7219 *self)
+  {
+  return self->scroll_offset;
+  }
+
+/** pico7219_set_vscroll_offset() */ 
+void pico7219_set_vscroll_offset (struct Pico7219 *self, int offset)
+  {
+  offset %= PICO7219_ROWS;
+  if (offset < 0) offset += PICO7219_ROWS;
+  self->vscroll_offset = offset;
+  memset (self->row_dirty, TRUE, sizeof (self->row_dirty));
+  }
+
+/** pico7219_get_vscroll_offset() */ 
+int pico7219_get_vscroll_offset (const struct Pico7219 *self)
+  {
+  return self->vscroll_offset;
+  }
+
+/** pico7219_begin_roll() */ 
+void pico7219_begin_roll (struct Pico7219 *self)
+  {
+  // Take the rows as they are displayed now -- including any roll 
+  //   already in progress -- before starting the new one
+  for (int i = 0; i < PICO7219_ROWS; i++)
+    pico7219_vrow_to_row (self, i, self->roll_old[i]);
+  self->roll_active = TRUE;
+  self->roll_rows = 0;
+  memset (self->row_dirty, TRUE, sizeof (self->row_dirty));
+  }
+
+/** pico7219_roll_step() */ 
+BOOL pico7219_roll_step (struct Pico7219 *self)
+  {
+  if (!self->roll_active) return FALSE;
+  self->roll_rows++;
+  if (self->roll_rows >= PICO7219_ROWS)
+    {
+    self->roll_active = FALSE;
+    self->roll_rows = 0;
+    }
+  memset (self->row_dirty, TRUE, sizeof (self->row_dirty));
+  return self->roll_active;
   }
 
 /** pico7219_get_virtual_chain_length() */ 
 int pico7219_get_virtual_chain_length (const struct Pico7219 *self)
   {
-  return self->vchain_len;
+  return self->draw->vchain_len;
   }
 
-/** pico7219_create() */
-struct Pico7219 *pico7219_create (enum PicoSpiNum spi_num, int32_t baud,
-         uint8_t mosi, uint8_t sck, uint8_t cs, uint8_t chain_len, 
+/** pico7219_grow_virtual_chain() */ 
+BOOL pico7219_grow_virtual_chain (struct Pico7219 *self, int chain_len)
+  {
+  return pico7219_buffer_grow (self->draw, chain_len);
+  }
+
+/** pico7219_set_double_buffered() */ 
+void pico7219_set_double_buffered (struct Pico7219 *self, BOOL on)
+  {
+  pico7219_wait (self);
+  if (on && self->draw == self->show)
+    {
+    // If there isn't room for a complete copy, stay single-buffered
+    if (pico7219_buffer_copy (&self->buffers[1], self->show))
+      {
+      self->draw = &self->buffers[1];
+      memset (self->draw_dirty, 0, sizeof (self->draw_dirty));
+      }
+    else
+      pico7219_buffer_free (&self->buffers[1]);
+    }
+  else if (!on && self->draw != self->show)
+    {
+    // Carry on with whatever is being displayed. This needn't be 
+    //   copied, only moved into buffers[0].
+    if (self->show != &self->buffers[0])
+      {
+      struct Pico7219Buffer t = self->buffers[0];
+      self->buffers[0] = self->buffers[1];
+      self->buffers[1] = t;
+      }
+    pico7219_buffer_free (&self->buffers[1]);
+    self->draw = self->show = &self->buffers[0];
+    }
+  self->commit_pending = FALSE;
+  }
+
+/** pico7219_commit() */ 
+void pico7219_commit (struct Pico7219 *self, BOOL keep_phase)
+  {
+  self->commit_pending = TRUE;
+  self->commit_keep_phase = keep_phase;
+  }
+
+/** Carry out a commit, if one is pending. This is called at the start
+    of each flush, so the swap always falls between frames. After the
+    swap the new drawing buffer is brought up to date, so that drawing 
+    can carry on from what is now displayed. If the chain length and
+    the scroll phase stay the same, only the rows that were drawn on 
+    need to be flushed; otherwise the window moves, and they all do. */
+static void pico7219_apply_commit (struct Pico7219 *self)
+  {
+  if (!self->commit_pending) return;
+  self->commit_pending = FALSE;
+  BOOL same_length = TRUE;
+  if (self->draw != self->show)
+    {
+    same_length = self->draw->vchain_len == self->show->vchain_len;
+    struct Pico7219Buffer *t = self->show;
+    self->show = self->draw;
+    self->draw = t;
+    // If memory runs out, drawing carries on in a shortened copy
+    pico7219_buffer_copy (self->draw, self->show);
+    }
+  int offset = self->commit_keep_phase ? self->scroll_offset : 0;
+  int voffset = self->commit_keep_phase ? self->vscroll_offset : 0;
+  if (same_length && offset == self->scroll_offset 
+       && voffset == self->vscroll_offset)
+    {
+    for (int i = 0; i < PICO7219_ROWS; i++)
+      if (self->draw_dirty[i]) self->row_dirty[i] = TRUE;
+    }
+  else
+    {
+    // This makes every row dirty
+    pico7219_set_scroll_offset (self, offset);
+    self->vscroll_offset = voffset;
+    }
+  memset (self->draw_dirty, 0, sizeof (self->draw_dirty));
+  }
+
+/** pico7219_create_with_backend() */
+struct Pico7219 *pico7219_create_with_backend 
+         (struct Pico7219Backend *backend, uint8_t chain_len, 
 	 BOOL reverse_bits)
   {
+  if (!backend) return NULL;
   struct Pico7219 *self = malloc (sizeof (struct Pico7219));  
   if (self)
     {
+    self->backend = backend;
     self->chain_len = chain_len;
-    self->cs = cs;
-    self->spi_num = spi_num;
     self->reverse_bits = reverse_bits;
-    self->vdata = NULL;
-    self->vchain_len = 0;
+    memset (self->buffers, 0, sizeof (self->buffers));
+    self->draw = self->show = &self->buffers[0];
+    self->commit_pending = FALSE;
+    self->commit_keep_phase = FALSE;
+    self->scroll_offset = 0;
+    self->vscroll_offset = 0;
+    self->roll_active = FALSE;
+    self->roll_rows = 0;
+    self->frame_rows = 0;
+    self->busy = FALSE;
+    self->flush_callback = NULL;
+    self->flush_user_data = NULL;
+    memset (&self->stats, 0, sizeof (self->stats));
     // Start with the virtual chain length the same as the 
     //  physical chain length
-    pico7219_set_virtual_chain_length (self, chain_len);
-    // Set data buffer to all "off", as that's how the LEDs power up
+    if (!pico7219_buffer_alloc (self->draw, chain_len))
+      {
+      free (self);
+      backend->destroy (backend, FALSE);
+      return NULL;
+      }
+    // Set data buffer to all "off", as that's what init() writes
     memset (self->data, 0, sizeof (self->data));
+    self->data_valid = TRUE;
     // Set all data clean
     memset (self->row_dirty, 0, sizeof (self->row_dirty));
-#if PICO_ON_DEVICE
-    switch (spi_num)
-      {
-      case PICO_SPI_0:
-        self->spi = spi0;
-	break;
-      case PICO_SPI_1:
-        self->spi = spi1;
-	break;
-      }
-
-    // Initialize the SPI and GPIO 
-    
-    spi_init (self->spi, baud); 
-
-    gpio_set_function(mosi, GPIO_FUNC_SPI);
-    gpio_set_function(sck, GPIO_FUNC_SPI);
-
-    gpio_init (self->cs);
-    gpio_set_dir (self->cs, GPIO_OUT);
-    gpio_put (self->cs, 1);
-#else
-printf ("Init SPI %d at %d baud, mosi=%d, sck=%d, cs=%d\n", 
-     self->spi_num, baud, mosi, sck, self->cs);
-#endif
+    memset (self->draw_dirty, 0, sizeof (self->draw_dirty));
 
     // Initialize the hardware
     pico7219_init (self);
     }
+  else
+    backend->destroy (backend, FALSE);
   return self;
   }
 
+/** pico7219_create() */
+struct Pico7219 *pico7219_create (enum PicoSpiNum spi_num, int32_t baud,
+         uint8_t mosi, uint8_t sck, uint8_t cs, uint8_t chain_len, 
+	 BOOL reverse_bits)
+  {
+#if PICO_ON_DEVICE
+  struct Pico7219Backend *backend = 
+    pico7219_dma_backend_create (spi_num, baud, mosi, sck, cs);
+#else
+  if (PICO7219_SIM_TRACE)
+    fprintf (stderr, "Init SPI %d at %d baud, mosi=%d, sck=%d, cs=%d\n", 
+      spi_num, baud, mosi, sck, cs);
+  struct Pico7219Backend *backend = 
+    pico7219_sim_backend_create (chain_len, cs, PICO7219_SIM_TRACE);
+#endif
+  return pico7219_create_with_backend (backend, chain_len, reverse_bits);
+  }
+
 /** pico7219_destroy() */
 void pico7219_destroy (struct Pico7219 *self, BOOL deinit)
   {
   if (self)
     {
-    if (self->vdata) free (self->vdata);
+    pico7219_buffer_free (&self->buffers[0]);
+    pico7219_buffer_free (&self->buffers[1]);
     pico7219_write_word_to_chain (self, PICO7219_SHUTDOWN_REG, 0x00); // off 
-    if (deinit)
+    self->backend->destroy (self->backend, deinit);
+    free (self);
+    }
+  }
+
+/** Fill buf with the 2-byte module words that write one row of bits
+    to the whole chain. The module furthest from the input has to be
+    sent first. Modules whose row register already holds the right 
+    value (according to the shadow in self->data) get the MAX7219 no-op
+    word, so the register is left alone. Unless force is TRUE, nothing
+    is staged if no module has changed. Returns the number of bytes 
+    staged, which is either zero or twice the chain length. The shadow
+    is updated to match. */
+static int pico7219_stage_row (struct Pico7219 *self, uint8_t row,
+        const uint8_t *bits, uint8_t *buf, BOOL force)
+  {
+  int chain_len = self->chain_len;
+  uint8_t *shadow = self->data[row];
+  if (!self->data_valid) force = TRUE;
+  BOOL changed = FALSE;
+  for (int i = 0; i < chain_len; i++)
+    {
+    int module = chain_len - i - 1;
+    uint8_t v = bits[module];
+    if (force || v != shadow[module])
       {
-#if PICO_ON_DEVICE
-      spi_deinit (self->spi);
-#endif
+      shadow[module] = v;
+      if (self->reverse_bits)
+        v = rev_table [v];
+      buf[2 * i] = row + 1;
+      buf[2 * i + 1] = v;
+      changed = TRUE;
+      }
+    else
+      {
+      buf[2 * i] = PICO7219_NOOP_REG;
+      buf[2 * i + 1] = 0x00;
       }
-    free (self);
     }
+  return changed ? 2 * chain_len : 0;
   }
 
-/** reverse_bits() reverses the order of bits in a specific byte. */
-static uint8_t pico7219_reverse_bits (uint8_t b)
+/** Write a staged row to the chain in one SPI operation. */
+static void pico7219_write_row (struct Pico7219 *self, 
+        const uint8_t *buf, int len)
   {
-  b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
-  b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
-  b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
-  return b;
+  self->backend->write (self->backend, buf, len);
+  PICO7219_COUNT (rows_written, 1);
+  PICO7219_COUNT (spi_bytes, len);
   }
 
 /** pico7219_set_row_bits(). */
-void pico7219_set_row_bits (const struct Pico7219 *self, uint8_t row, 
+void pico7219_set_row_bits (struct Pico7219 *self, uint8_t row, 
         const uint8_t bits[PICO7219_MAX_CHAIN]) 
   {
-  pico7219_cs (self, 0); 
-  int chain_len = self->chain_len;
-  for (int i = 0; i < chain_len; i++)
-    {
-    uint8_t v = bits[chain_len - i - 1];
-    if (self->reverse_bits)
-      v = rev_table [v];
-    uint8_t buf[] = {row + 1, v};
-#if PICO_ON_DEVICE
-    spi_write_blocking (self->spi, buf, 2);
-#else
-    printf ("SPI write %02x %02x\n", buf[0], buf[1]);
-#endif
-    }
-  pico7219_cs (self, 1); 
+  uint8_t buf[2 * PICO7219_MAX_CHAIN];
+  pico7219_wait (self);
+  int len = pico7219_stage_row (self, row, bits, buf, TRUE);
+  pico7219_write_row (self, buf, len);
+  }
+
+/** pico7219_invalidate() */
+void pico7219_invalidate (struct Pico7219 *self)
+  {
+  self->data_valid = FALSE;
+  memset (self->row_dirty, TRUE, sizeof (self->row_dirty));
   }
 
 /** pico7219_switch_off_row() */
 void pico7219_switch_off_row (struct Pico7219 *self, uint8_t row, BOOL flush)
   {
-  self->row_dirty[row] = TRUE;
-  //fprintf (stderr, "row = %d len=%d\n", row, self->vchain_len);
-  memset (self->vdata + row * self->vchain_len, 0x0, self->vchain_len);
+  pico7219_row_changed (self, row);
+  struct Pico7219Buffer *b = self->draw;
+  memset (b->vdata + row * b->vcap, 0x0, b->vchain_len);
   if (flush) pico7219_flush (self);
   }
 
@@ -252,8 +647,9 @@ void pico7219_switch_off_all (struct Pico7219 *self, BOOL flush)
 /** pico7219_switch_on_row() */
 void pico7219_switch_on_row (struct Pico7219 *self, uint8_t row, BOOL flush)
   {
-  self->row_dirty[row] = TRUE;
-  memset (self->vdata + row * self->vchain_len, 0xFF, self->vchain_len);
+  pico7219_row_changed (self, row);
+  struct Pico7219Buffer *b = self->draw;
+  memset (b->vdata + row * b->vcap, 0xFF, b->vchain_len);
   if (flush) pico7219_flush (self);
   }
 
@@ -265,105 +661,369 @@ void pico7219_switch_on_all (struct Pico7219 *self, BOOL flush)
   if (flush) pico7219_flush (self);
   }
 
+/** pico7219_set_vrow_bytes() */
+void pico7219_set_vrow_bytes (struct Pico7219 *self, uint8_t row, 
+       int module, const uint8_t *bits, int n, BOOL flush)
+  {
+  struct Pico7219Buffer *b = self->draw;
+  if (row >= PICO7219_ROWS || module < 0 || module >= b->vchain_len) return;
+  if (n > b->vchain_len - module) n = b->vchain_len - module;
+  memcpy (b->vdata + row * b->vcap + module, bits, n);
+  pico7219_row_changed (self, row);
+  if (flush) pico7219_flush (self);
+  }
+
+/** pico7219_xor_vrow_bytes() */
+void pico7219_xor_vrow_bytes (struct Pico7219 *self, uint8_t row, 
+       int module, const uint8_t *bits, int n, BOOL flush)
+  {
+  struct Pico7219Buffer *b = self->draw;
+  if (row >= PICO7219_ROWS || module < 0 || module >= b->vchain_len) return;
+  if (n > b->vchain_len - module) n = b->vchain_len - module;
+  uint8_t *p = b->vdata + row * b->vcap + module;
+  for (int i = 0; i < n; i++)
+    p[i] ^= bits[i];
+  pico7219_row_changed (self, row);
+  if (flush) pico7219_flush (self);
+  }
+
+/** pico7219_set_columns() */
+void pico7219_set_columns (struct Pico7219 *self, int col, 
+       const uint8_t *cols, int n, BOOL flush)
+  {
+  struct Pico7219Buffer *b = self->draw;
+  if (col < 0)
+    {
+    cols -= col;
+    n += col;
+    col = 0;
+    }
+  if (n > PICO7219_COLS * b->vchain_len - col) 
+    n = PICO7219_COLS * b->vchain_len - col;
+  if (n <= 0) return;
+  // Work one module at a time: transpose the columns that fall in it
+  //   into eight row bytes, and merge them into the rows, leaving the 
+  //   columns outside the run alone
+  int end = col + n;
+  for (int block = col / 8; block * 8 < end; block++)
+    {
+    uint8_t rows[PICO7219_ROWS] = { 0 };
+    uint8_t mask = 0;
+    for (int k = 0; k < 8; k++)
+      {
+      int c = block * 8 + k;
+      if (c < col || c >= end) continue;
+      uint8_t v = cols[c - col];
+      mask |= 1 << k;
+      for (int row = 0; row < PICO7219_ROWS; row++)
+        rows[row] |= ((v >> row) & 1) << k;
+      }
+    uint8_t *p = b->vdata + block;
+    for (int row = 0; row < PICO7219_ROWS; row++, p += b->vcap)
+      *p = (*p & ~mask) | rows[row];
+    }
+  pico7219_row_changed (self, -1);
+  if (flush) pico7219_flush (self);
+  }
+
+/** pico7219_blit() */
+void pico7219_blit (struct Pico7219 *self, int col, 
+       const uint8_t bits[PICO7219_ROWS], BOOL msb_first, BOOL flush)
+  {
+  struct Pico7219Buffer *b = self->draw;
+  if (col < 0 || col >= PICO7219_COLS * b->vchain_len) return;
+  int block = col / 8;
+  int shift = col - 8 * block;
+  BOOL spill = shift && block + 1 < b->vchain_len;
+  uint8_t *p = b->vdata + block;
+  for (int row = 0; row < PICO7219_ROWS; row++, p += b->vcap)
+    {
+    uint8_t v = msb_first ? rev_table [bits[row]] : bits[row];
+    p[0] |= v << shift;
+    if (spill) p[1] |= v >> (8 - shift);
+    pico7219_row_changed (self, row);
+    }
+  if (flush) pico7219_flush (self);
+  }
+
 /** pico7219_switch_on() */
 void pico7219_switch_on (struct Pico7219 *self, uint8_t row, 
-       uint8_t col, BOOL flush)
+       int col, BOOL flush)
   {
-  if (row < PICO7219_ROWS && col < PICO7219_COLS * self->vchain_len)
+  struct Pico7219Buffer *b = self->draw;
+  if (row < PICO7219_ROWS && col >= 0 
+       && col < PICO7219_COLS * b->vchain_len)
     {
     int block = col / 8;
     int pos = col - 8 * block;
     uint8_t v = 1 << pos;
-    self->vdata[row * self->vchain_len + block] |= v;
-    self->row_dirty[row] = TRUE;
+    b->vdata[row * b->vcap + block] |= v;
+    pico7219_row_changed (self, row);
     if (flush) pico7219_flush (self);
     } 
   }
 
 /** pico7219_switch_off() */
 void pico7219_switch_off (struct Pico7219 *self, uint8_t row, 
-       uint8_t col, BOOL flush)
+       int col, BOOL flush)
   {
-  if (row < PICO7219_ROWS && col < PICO7219_COLS * self->vchain_len)
+  struct Pico7219Buffer *b = self->draw;
+  if (row < PICO7219_ROWS && col >= 0 
+       && col < PICO7219_COLS * b->vchain_len)
     {
     int block = col / 8;
     int pos = col - 8 * block;
     uint8_t v = 1 << pos;
-    self->vdata[row * self->vchain_len + block] &= ~v;
-    self->row_dirty[row] = TRUE;
+    b->vdata[row * b->vcap + block] &= ~v;
+    pico7219_row_changed (self, row);
     if (flush) pico7219_flush (self);
     }
   }
 
-/** Copy from the virtual chain to self->data, preparatory to 
-    writing to the device. This function will only write the start
-    of the virtual chain, if it is longer than the physical chain. */
-static void pico7219_vrow_to_row (struct Pico7219 *self, int row)
+/** pico7219_hline() */
+void pico7219_hline (struct Pico7219 *self, uint8_t row, int col, int len,
+       BOOL on, BOOL flush)
   {
-  int target_mods = self->chain_len;
-  if (target_mods > self->vchain_len) target_mods = self->vchain_len;
-  int row_start = row * self->vchain_len;
-  for (int i = 0; i < target_mods; i++)
+  struct Pico7219Buffer *b = self->draw;
+  int end = col + len; // One past the last column
+  if (col < 0) col = 0;
+  if (end > PICO7219_COLS * b->vchain_len) 
+    end = PICO7219_COLS * b->vchain_len;
+  if (row >= PICO7219_ROWS || col >= end) return;
+  uint8_t *vrow = b->vdata + row * b->vcap;
+  int first = col / 8, last = (end - 1) / 8;
+  // The bits of the first and last bytes that are in the line
+  uint8_t first_mask = 0xFF << (col % 8);
+  uint8_t last_mask = 0xFF >> (7 - (end - 1) % 8);
+  if (first == last)
+    first_mask &= last_mask;
+  else
     {
-    self->data[row][i] = self->vdata[row_start + i];
+    memset (vrow + first + 1, on ? 0xFF : 0x00, last - first - 1);
+    if (on)
+      vrow[last] |= last_mask;
+    else
+      vrow[last] &= ~last_mask;
     }
+  if (on)
+    vrow[first] |= first_mask;
+  else
+    vrow[first] &= ~first_mask;
+  pico7219_row_changed (self, row);
+  if (flush) pico7219_flush (self);
   }
 
-/** Scroll one pixel left. */
-void pico7219_scroll (struct Pico7219 *self, BOOL wrap)
+/** pico7219_fill_rect() */
+void pico7219_fill_rect (struct Pico7219 *self, int row, int col, 
+       int height, int width, BOOL on, BOOL flush)
+  {
+  int end = row + height;
+  if (row < 0) row = 0;
+  if (end > PICO7219_ROWS) end = PICO7219_ROWS;
+  for (; row < end; row++)
+    pico7219_hline (self, row, col, width, on, FALSE);
+  if (flush) pico7219_flush (self);
+  }
+
+/** Copy from the virtual chain to bits, preparatory to 
+    writing display row "row" to the device. Only the part of the 
+    virtual chain that falls under the display window (starting at 
+    scroll_offset) is copied. Because the window can start part-way 
+    through a byte, each output byte is a funnel shift of two adjacent
+    bytes of vdata. The cost depends on the physical chain length, not
+    the virtual one. Vertical scrolling and rolling only change which
+    row is copied. */
+static void pico7219_vrow_to_row (const struct Pico7219 *self, int row,
+        uint8_t bits[PICO7219_MAX_CHAIN])
   {
+  if (self->roll_active)
+    {
+    // The old rows have moved up by roll_rows, and the top rows of the
+    //   new contents are below them 
+    if (row >= self->roll_rows)
+      {
+      memcpy (bits, self->roll_old[row - self->roll_rows], self->chain_len);
+      return;
+      }
+    row += PICO7219_ROWS - self->roll_rows;
+    }
+  row = (row + self->vscroll_offset) % PICO7219_ROWS;
+  int vchain_len = self->show->vchain_len;
   int target_mods = self->chain_len;
-  if (target_mods > self->vchain_len) target_mods = self->vchain_len;
+  if (target_mods > vchain_len) target_mods = vchain_len;
+  const uint8_t *vrow = self->show->vdata + row * self->show->vcap;
+  int block = self->scroll_offset / 8;
+  int shift = self->scroll_offset - 8 * block;
+  for (int i = 0; i < target_mods; i++)
+    {
+    int next = block + 1;
+    if (next == vchain_len) next = 0;
+    if (shift)
+      bits[i] = (vrow[block] >> shift) | (uint8_t)(vrow[next] << (8 - shift));
+    else
+      bits[i] = vrow[block];
+    block = next;
+    }
+  for (int i = target_mods; i < self->chain_len; i++)
+    bits[i] = 0;
+  }
 
-  // Shift bits in vdata
+/** Shift the whole virtual chain one pixel left, discarding the pixels
+    that fall off the start. This is the non-wrapping scroll, which
+    really does have to move every bit. */
+static void pico7219_shift_left (struct Pico7219 *self)
+  {
   // This logic is twisted because the bits are in MSB-LSB order in the 
   //   opposite order from the modules. So when we shift a bit rightwards
   //   off the end of one module, it appears as the MSB in the next, not
   //   the LSB.
   for (int row = 0; row < PICO7219_ROWS; row++)
     {
-    int row_start = row * self->vchain_len;
+    struct Pico7219Buffer *b = self->show;
+    uint8_t *vrow = b->vdata + row * b->vcap;
+    uint8_t carry = 0;
+    for (int i = b->vchain_len - 1; i >= 0; i--)
+      {
+      uint8_t carry_next = (vrow[i] & 0x01) ? 0x80 : 0;
+      vrow[i] = (vrow[i] >> 1) | carry; 
+      carry = carry_next;
+      }
+    }
+  }
+
+/** Shift the whole virtual chain one pixel right, discarding the pixels
+    that fall off the end. The mirror image of shift_left(). */
+static void pico7219_shift_right (struct Pico7219 *self)
+  {
+  for (int row = 0; row < PICO7219_ROWS; row++)
+    {
+    struct Pico7219Buffer *b = self->show;
+    uint8_t *vrow = b->vdata + row * b->vcap;
     uint8_t carry = 0;
-    int l = self->vchain_len - 1;
-    for (int i = l; i >= 0; i--)
+    for (int i = 0; i < b->vchain_len; i++)
       {
-      int row_offset = row_start + i;
-      BOOL carry_next = FALSE;
-
-      if (self->vdata[row_offset] & 0x01) carry_next = TRUE;
-      self->vdata[row_offset] >>= 1; 
-
-      // If we're at position 0, and the shift would carry, we have to
-      //   carry to position "-1" which, of course, does not exist. So,
-      //   instead, we carry to position l, that is, to the far end of
-      //   the chain.
-      if (wrap)
-        {
-        if (i == 0 && carry_next)
-          self->vdata[row_start + l] |= 0x80;
-        }
-
-      self->vdata[row_offset] |= carry; 
-      carry = 0;
-
-      if (carry_next)
-	carry = 0x80;
+      uint8_t carry_next = (vrow[i] & 0x80) ? 0x01 : 0;
+      vrow[i] = (vrow[i] << 1) | carry; 
+      carry = carry_next;
       }
+    }
+  }
+
+/** Scroll one pixel left. With wrap, vdata is left alone and only the
+    display window moves, so the work done is the same however long
+    the virtual chain is. */
+void pico7219_scroll (struct Pico7219 *self, BOOL wrap)
+  {
+  if (wrap)
+    pico7219_set_scroll_offset (self, self->scroll_offset + 1);
+  else
+    {
+    pico7219_shift_left (self);
+    memset (self->row_dirty, TRUE, sizeof (self->row_dirty));
+    }
+  pico7219_flush (self);
+  }
 
-    pico7219_set_row_bits (self, row, self->vdata + row * self->vchain_len);
+/** pico7219_scroll_right() */
+void pico7219_scroll_right (struct Pico7219 *self, BOOL wrap)
+  {
+  if (wrap)
+    pico7219_set_scroll_offset (self, self->scroll_offset - 1);
+  else
+    {
+    pico7219_shift_right (self);
+    memset (self->row_dirty, TRUE, sizeof (self->row_dirty));
     }
+  pico7219_flush (self);
   }
 
 /** pico7219_flush() */
 void pico7219_flush (struct Pico7219 *self)
   {
+  uint8_t bits[PICO7219_MAX_CHAIN];
+  uint8_t buf[2 * PICO7219_MAX_CHAIN];
+  pico7219_wait (self);
+#if PICO7219_STATS
+  uint32_t start = time_us_32();
+#endif
+  pico7219_apply_commit (self);
+  for (int i = 0; i < PICO7219_ROWS; i++)
+    {
+    if (self->row_dirty[i])
+      {
+      pico7219_vrow_to_row (self, i, bits);
+      int len = pico7219_stage_row (self, i, bits, buf, FALSE);
+      if (len) pico7219_write_row (self, buf, len);
+      }
+    self->row_dirty[i] = FALSE;
+    }
+  self->data_valid = TRUE;
+  PICO7219_COUNT (flushes, 1);
+#if PICO7219_STATS
+  pico7219_timer_add (&self->stats.flush_time, time_us_32() - start);
+#endif
+  }
+
+/** Called when the last row of an async flush has been sent. */
+static void pico7219_flush_complete (struct Pico7219 *self)
+  {
+#if PICO7219_STATS
+  pico7219_timer_add (&self->stats.flush_time, 
+    time_us_32() - self->flush_start);
+#endif
+  self->busy = FALSE;
+  if (self->flush_callback)
+    self->flush_callback (self, self->flush_user_data);
+  }
+
+/** Called by the backend when it has sent an async flush. */
+static void pico7219_backend_done (void *ctx)
+  {
+  pico7219_flush_complete ((struct Pico7219 *)ctx);
+  }
+
+/** pico7219_flush_async() */
+void pico7219_flush_async (struct Pico7219 *self, 
+        Pico7219FlushCallback callback, void *user_data)
+  {
+  pico7219_wait (self);
+#if PICO7219_STATS
+  self->flush_start = time_us_32();
+#endif
+  PICO7219_COUNT (flushes, 1);
+  pico7219_apply_commit (self);
+  self->flush_callback = callback;
+  self->flush_user_data = user_data;
+  self->frame_rows = 0;
+  uint8_t bits[PICO7219_MAX_CHAIN];
   for (int i = 0; i < PICO7219_ROWS; i++)
     {
-    pico7219_vrow_to_row (self, i);
     if (self->row_dirty[i])
-      pico7219_set_row_bits (self, i, self->data[i]);
+      {
+      pico7219_vrow_to_row (self, i, bits);
+      if (pico7219_stage_row (self, i, bits, 
+            self->frame[self->frame_rows], FALSE))
+        self->frame_rows++;
+      }
     self->row_dirty[i] = FALSE;
     }
+  self->data_valid = TRUE;
+
+  self->busy = TRUE;
+  if (self->frame_rows > 0 && self->backend->write_async 
+       && self->backend->write_async (self->backend, self->frame[0], 
+            sizeof (self->frame[0]), 2 * self->chain_len, 
+            self->frame_rows, pico7219_backend_done, self))
+    {
+    PICO7219_COUNT (rows_written, self->frame_rows);
+    PICO7219_COUNT (spi_bytes, self->frame_rows * 2 * self->chain_len);
+    return;
+    }
+  // The backend can't send in the background (or there's nothing to 
+  //   send) -- do the whole thing now
+  for (int i = 0; i < self->frame_rows; i++)
+    pico7219_write_row (self, self->frame[i], 2 * self->chain_len);
+  pico7219_flush_complete (self);
   }
 
 /** pico7219_set_intensity() */
@@ -372,4 +1032,16 @@ void pico7219_set_intensity (struct Pico7219 *self, uint8_t intensity)
   pico7219_write_word_to_chain (self, PICO7219_INTENSITY_REG, intensity); 
   }
 
+/** pico7219_get_stats() */
+void pico7219_get_stats (const struct Pico7219 *self, 
+        struct Pico7219Stats *stats)
+  {
+  *stats = self->stats;
+  }
+
+/** pico7219_reset_stats() */
+void pico7219_reset_stats (struct Pico7219 *self)
+  {
+  memset (&self->stats, 0, sizeof (self->stats));
+  }
 
@@ -0,0 +1,140 @@
+/*=========================================================================
+
+  Pico7219
+
+  pico7219_sim.c
+
+  A backend for the Pico7219 library that simulates a chain of MAX7219s.
+  The bytes sent are clocked into a model of the chain's shift registers
+  and, when chip-select is raised, each module's 16-bit word is decoded
+  into its registers, just as the real chips do. So a short write leaves
+  the modules furthest from the input holding whatever was shifted into
+  them earlier, as it would on real hardware.
+
+  Copyright (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "pico7219/pico7219_backend.h"
+
+struct Pico7219Sim
+  {
+  struct Pico7219Backend backend; // Must be first
+  int chain_len;
+  uint8_t cs; // Only used for tracing
+  BOOL trace;
+  // The shift registers of the whole chain, two bytes per module.
+  //   shift[2 * m] is the low byte of module m, where module 0 is
+  //   nearest the input.
+  uint8_t *shift;
+  // The registers of each module, PICO7219_REGS for each
+  uint8_t *regs;
+  struct Pico7219SimStats stats;
+  };
+
+/** Clock one byte into the chain. Everything already there moves two
+    bytes -- one module -- towards the far end, a byte at a time. */
+static void pico7219_sim_shift_in (struct Pico7219Sim *self, uint8_t b)
+  {
+  memmove (self->shift + 1, self->shift, 2 * self->chain_len - 1);
+  self->shift[0] = b;
+  }
+
+/** Raise chip-select: every module latches the word in its shift
+    register, unless it's a no-op. */
+static void pico7219_sim_latch (struct Pico7219Sim *self)
+  {
+  for (int m = 0; m < self->chain_len; m++)
+    {
+    int reg = self->shift[2 * m + 1] & 0x0F;
+    if (reg != 0)
+      {
+      self->regs[m * PICO7219_REGS + reg] = self->shift[2 * m];
+      self->stats.register_writes++;
+      }
+    }
+  self->stats.transactions++;
+  }
+
+/** The backend write() function. */
+static void pico7219_sim_write (struct Pico7219Backend *backend,
+        const uint8_t *buf, int len)
+  {
+  struct Pico7219Sim *self = (struct Pico7219Sim *)backend;
+  if (self->trace) fprintf (stderr, "Set GPIO %d = 0\n", self->cs);
+  for (int i = 0; i < len; i++)
+    {
+    pico7219_sim_shift_in (self, buf[i]);
+    if (self->trace && i % 2 == 1)
+      fprintf (stderr, "SPI write %02x %02x\n", buf[i - 1], buf[i]);
+    }
+  self->stats.bytes += len;
+  pico7219_sim_latch (self);
+  if (self->trace) fprintf (stderr, "Set GPIO %d = 1\n", self->cs);
+  }
+
+/** The backend destroy() function. */
+static void pico7219_sim_destroy (struct Pico7219Backend *backend,
+        BOOL deinit)
+  {
+  (void)deinit;
+  struct Pico7219Sim *self = (struct Pico7219Sim *)backend;
+  free (self->shift);
+  free (self->regs);
+  free (self);
+  }
+
+/** pico7219_sim_backend_create() */
+struct Pico7219Backend *pico7219_sim_backend_create (int chain_len,
+        uint8_t cs, BOOL trace)
+  {
+  struct Pico7219Sim *self = malloc (sizeof (struct Pico7219Sim));
+  if (self)
+    {
+    self->backend.write = pico7219_sim_write;
+    self->backend.write_async = NULL;
+    self->backend.destroy = pico7219_sim_destroy;
+    self->chain_len = chain_len;
+    self->cs = cs;
+    self->trace = trace;
+    self->shift = calloc (2 * chain_len, 1);
+    self->regs = calloc (chain_len * PICO7219_REGS, 1);
+    memset (&self->stats, 0, sizeof (self->stats));
+    if (!self->shift || !self->regs)
+      {
+      pico7219_sim_destroy (&self->backend, FALSE);
+      return NULL;
+      }
+    return &self->backend;
+    }
+  return NULL;
+  }
+
+/** pico7219_sim_get_register() */
+uint8_t pico7219_sim_get_register (const struct Pico7219Backend *backend,
+        int module, int reg)
+  {
+  const struct Pico7219Sim *self = (const struct Pico7219Sim *)backend;
+  if (module < 0 || module >= self->chain_len
+       || reg < 0 || reg >= PICO7219_REGS) return 0;
+  return self->regs[module * PICO7219_REGS + reg];
+  }
+
+/** pico7219_sim_get_stats() */
+void pico7219_sim_get_stats (const struct Pico7219Backend *backend,
+        struct Pico7219SimStats *stats)
+  {
+  const struct Pico7219Sim *self = (const struct Pico7219Sim *)backend;
+  *stats = self->stats;
+  }
+
+/** pico7219_sim_reset_stats() */
+void pico7219_sim_reset_stats (struct Pico7219Backend *backend)
+  {
+  struct Pico7219Sim *self = (struct Pico7219Sim *)backend;
+  memset (&self->stats, 0, sizeof (self->stats));
+  }
+
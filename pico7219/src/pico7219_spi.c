@@ -0,0 +1,237 @@
+/*=========================================================================
+
+  Pico7219
+
+  pico7219_spi.c
+
+  The backends for the Pico7219 library that drive a real chain of
+  MAX7219s, using the Pico's SPI hardware. The DMA backend differs from
+  the SPI backend only in being able to send a whole frame in the
+  background: the frame is a run of transactions, and the DMA completion
+  interrupt raises and lowers the chip-select line between them, and
+  starts the next one. One DMA channel feeds the SPI transmit FIFO, and
+  another empties the receive FIFO; the receive channel finishes only
+  when the last bit has been clocked out, so its interrupt comes when
+  the transaction is really over, and there is no need to wait for the
+  SPI to go idle in the interrupt handler.
+
+  Copyright (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#if PICO_ON_DEVICE
+
+#include <stdlib.h>
+#include <string.h>
+#include "hardware/spi.h"
+#include "hardware/gpio.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+
+#include "pico7219/pico7219_backend.h"
+
+struct Pico7219Spi
+  {
+  struct Pico7219Backend backend; // Must be first
+  spi_inst_t* spi; // The Pico-specific SPI device
+  uint8_t cs; // Chip select GPIO pin
+  int dma_chan; // DMA channel for background writes, or -1 if none
+  int rx_chan; // DMA channel that empties the receive FIFO
+  // The background write in progress
+  const uint8_t *async_buf;
+  int async_stride;
+  int async_len;
+  int async_n;
+  volatile int async_next; // Next transaction to send
+  Pico7219BackendDone async_done;
+  void *async_ctx;
+  };
+
+static void pico7219_spi_dma_irq (void);
+
+// The DMA interrupt handler has no way to be passed a context, so the
+//   (single) backend that owns the DMA channel is recorded here.
+static struct Pico7219Spi *pico7219_spi_dma_owner = NULL;
+
+// Where the receive channel puts the bytes it reads, which are not used
+static uint8_t pico7219_spi_rx_sink;
+
+/** Change the state of the chip-select line, allowing a very short
+    time for it to settle. */
+static void pico7219_spi_cs (const struct Pico7219Spi *self,
+        uint8_t select)
+  {
+  asm volatile("nop \n nop \n nop");
+  gpio_put (self->cs, select);
+  asm volatile("nop \n nop \n nop");
+  }
+
+/** The backend write() function. */
+static void pico7219_spi_write (struct Pico7219Backend *backend,
+        const uint8_t *buf, int len)
+  {
+  struct Pico7219Spi *self = (struct Pico7219Spi *)backend;
+  pico7219_spi_cs (self, 0);
+  spi_write_blocking (self->spi, buf, len);
+  pico7219_spi_cs (self, 1);
+  }
+
+/** Start the DMA transfer of the next transaction of a background
+    write. */
+static void pico7219_spi_dma_start (struct Pico7219Spi *self)
+  {
+  pico7219_spi_cs (self, 0);
+  dma_channel_set_trans_count (self->rx_chan, self->async_len, TRUE);
+  dma_channel_set_trans_count (self->dma_chan, self->async_len, FALSE);
+  dma_channel_set_read_addr (self->dma_chan,
+    self->async_buf + self->async_next * self->async_stride, TRUE);
+  }
+
+/** DMA completion handler, raised by the receive channel. That channel
+    takes the last byte of a transaction from the receive FIFO once it
+    has been clocked in, by which time it has also been clocked out, so
+    chip-select can be raised to latch the data straight away. The SPI
+    may stay busy for a few more system clock cycles, and the wait for
+    that is the only one in here: the handler runs for a few
+    microseconds, however long the chain or slow the SPI clock. */
+static void pico7219_spi_dma_irq (void)
+  {
+  struct Pico7219Spi *self = pico7219_spi_dma_owner;
+  if (!self || !dma_channel_get_irq0_status (self->rx_chan)) return;
+  dma_channel_acknowledge_irq0 (self->rx_chan);
+
+  while (spi_is_busy (self->spi))
+    tight_loop_contents();
+  pico7219_spi_cs (self, 1);
+
+  self->async_next++;
+  if (self->async_next < self->async_n)
+    pico7219_spi_dma_start (self);
+  else
+    self->async_done (self->async_ctx);
+  }
+
+/** The backend write_async() function. */
+static BOOL pico7219_spi_write_async (struct Pico7219Backend *backend,
+        const uint8_t *buf, int stride, int len, int n,
+        Pico7219BackendDone done, void *ctx)
+  {
+  struct Pico7219Spi *self = (struct Pico7219Spi *)backend;
+  if (self->dma_chan < 0 || n <= 0) return FALSE;
+  self->async_buf = buf;
+  self->async_stride = stride;
+  self->async_len = len;
+  self->async_n = n;
+  self->async_next = 0;
+  self->async_done = done;
+  self->async_ctx = ctx;
+  pico7219_spi_dma_start (self);
+  return TRUE;
+  }
+
+/** The backend destroy() function. */
+static void pico7219_spi_destroy (struct Pico7219Backend *backend,
+        BOOL deinit)
+  {
+  struct Pico7219Spi *self = (struct Pico7219Spi *)backend;
+  if (self->dma_chan >= 0)
+    {
+    dma_channel_set_irq0_enabled (self->rx_chan, FALSE);
+    dma_channel_unclaim (self->dma_chan);
+    dma_channel_unclaim (self->rx_chan);
+    irq_remove_handler (DMA_IRQ_0, pico7219_spi_dma_irq);
+    pico7219_spi_dma_owner = NULL;
+    }
+  if (deinit)
+    spi_deinit (self->spi);
+  free (self);
+  }
+
+/** pico7219_spi_backend_create() */
+struct Pico7219Backend *pico7219_spi_backend_create
+        (enum PicoSpiNum spi_num, int32_t baud, uint8_t mosi,
+        uint8_t sck, uint8_t cs)
+  {
+  struct Pico7219Spi *self = malloc (sizeof (struct Pico7219Spi));
+  if (self)
+    {
+    self->backend.write = pico7219_spi_write;
+    self->backend.write_async = pico7219_spi_write_async;
+    self->backend.destroy = pico7219_spi_destroy;
+    self->cs = cs;
+    self->dma_chan = -1;
+    self->rx_chan = -1;
+    switch (spi_num)
+      {
+      case PICO_SPI_0:
+        self->spi = spi0;
+	break;
+      case PICO_SPI_1:
+        self->spi = spi1;
+	break;
+      }
+
+    // Initialize the SPI and GPIO
+
+    spi_init (self->spi, baud);
+
+    gpio_set_function(mosi, GPIO_FUNC_SPI);
+    gpio_set_function(sck, GPIO_FUNC_SPI);
+
+    gpio_init (self->cs);
+    gpio_set_dir (self->cs, GPIO_OUT);
+    gpio_put (self->cs, 1);
+    return &self->backend;
+    }
+  return NULL;
+  }
+
+/** pico7219_dma_backend_create() */
+struct Pico7219Backend *pico7219_dma_backend_create
+        (enum PicoSpiNum spi_num, int32_t baud, uint8_t mosi,
+        uint8_t sck, uint8_t cs)
+  {
+  struct Pico7219Backend *backend =
+    pico7219_spi_backend_create (spi_num, baud, mosi, sck, cs);
+  if (!backend) return NULL;
+  struct Pico7219Spi *self = (struct Pico7219Spi *)backend;
+
+  // Set up a DMA channel to feed the SPI transmit FIFO, and another
+  //   to empty the receive FIFO. Only one backend can own the DMA 
+  //   interrupt; any others (and any backend that can't get two 
+  //   channels) just write synchronously.
+  if (!pico7219_spi_dma_owner)
+    {
+    int chan = dma_claim_unused_channel (FALSE);
+    int rx_chan = chan >= 0 ? dma_claim_unused_channel (FALSE) : -1;
+    if (rx_chan < 0 && chan >= 0)
+      dma_channel_unclaim (chan);
+    else if (rx_chan >= 0)
+      {
+      dma_channel_config c = dma_channel_get_default_config (chan);
+      channel_config_set_transfer_data_size (&c, DMA_SIZE_8);
+      channel_config_set_dreq (&c, spi_get_dreq (self->spi, TRUE));
+      channel_config_set_read_increment (&c, TRUE);
+      channel_config_set_write_increment (&c, FALSE);
+      dma_channel_configure (chan, &c, &spi_get_hw (self->spi)->dr,
+        NULL, 0, FALSE);
+      c = dma_channel_get_default_config (rx_chan);
+      channel_config_set_transfer_data_size (&c, DMA_SIZE_8);
+      channel_config_set_dreq (&c, spi_get_dreq (self->spi, FALSE));
+      channel_config_set_read_increment (&c, FALSE);
+      channel_config_set_write_increment (&c, FALSE);
+      dma_channel_configure (rx_chan, &c, &pico7219_spi_rx_sink,
+        &spi_get_hw (self->spi)->dr, 0, FALSE);
+      dma_channel_set_irq0_enabled (rx_chan, TRUE);
+      irq_add_shared_handler (DMA_IRQ_0, pico7219_spi_dma_irq,
+        PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+      irq_set_enabled (DMA_IRQ_0, TRUE);
+      self->dma_chan = chan;
+      self->rx_chan = rx_chan;
+      pico7219_spi_dma_owner = self;
+      }
+    }
+  return backend;
+  }
+
+#endif
+
@@ -0,0 +1,219 @@
+/*=========================================================================
+
+  Pico7219
+
+  parse_test.c
+
+  Tests of the firmware's parsing of host input: the arguments of text
+  commands (prog/parse.c), and the CRC and DELTA payload checks of
+  binary frames (prog/frame.c). These don't touch the display at all.
+  Built and run by ctest in the host build.
+
+  Copyright (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#include <stdio.h>
+#include <string.h>
+
+#include "prog/frame.h"
+#include "prog/parse.h"
+
+// Number of checks that have failed
+static int failures = 0;
+
+#define CHECK(cond) \
+  do { if (!(cond)) { \
+    fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+      #cond); \
+    failures++; } } while (0)
+
+//
+// int_is
+//
+// Returns TRUE if s holds one integer, with the given value, and
+// nothing after it
+//
+static BOOL int_is (const char *s, int value)
+  {
+  int v;
+  return parse_int (&s, &v) && v == value && *s == 0;
+  }
+
+//
+// test_parse_int
+//
+// Integers can have blanks before them and a minus sign, but no more
+// than MAX_DIGITS digits, and parsing stops at the first non-digit
+//
+static void test_parse_int (void)
+  {
+  CHECK (int_is ("0", 0));
+  CHECK (int_is ("123", 123));
+  CHECK (int_is (" \t-45", -45));
+  CHECK (int_is ("999999999", 999999999));
+  CHECK (int_is ("-999999999", -999999999));
+  CHECK (int_is ("000000001", 1));
+
+  int v = 7;
+  const char *s = "1234567890";
+  CHECK (!parse_int (&s, &v));
+  CHECK (v == 7);
+  s = "";
+  CHECK (!parse_int (&s, &v));
+  s = "-";
+  CHECK (!parse_int (&s, &v));
+  s = "- 1";
+  CHECK (!parse_int (&s, &v));
+  s = "x1";
+  CHECK (!parse_int (&s, &v));
+  s = "12,3";
+  CHECK (parse_int (&s, &v) && v == 12 && *s == ',');
+  s = "5 ";
+  CHECK (parse_int (&s, &v) && v == 5 && *s == ' ');
+  }
+
+//
+// test_parse_ints
+//
+// Lists of integers, with blanks before each one, and at the end
+//
+static void test_parse_ints (void)
+  {
+  int v[4];
+  CHECK (parse_ints ("", v, 4) == 0);
+  CHECK (parse_ints (" \r", v, 4) == 0);
+  CHECK (parse_ints ("1,-2, 3 \r", v, 4) == 3);
+  CHECK (v[0] == 1 && v[1] == -2 && v[2] == 3);
+  CHECK (parse_ints ("1,2,3,4", v, 4) == 4);
+  CHECK (parse_ints ("1,2,3,4,5", v, 4) == -1);
+  CHECK (parse_ints ("1,,2", v, 4) == -1);
+  CHECK (parse_ints ("1,2,", v, 4) == -1);
+  CHECK (parse_ints ("1 ,2", v, 4) == -1);
+  CHECK (parse_ints ("1x", v, 4) == -1);
+  CHECK (parse_ints ("1,1234567890", v, 4) == -1);
+  }
+
+//
+// test_parse_hex
+//
+static void test_parse_hex (void)
+  {
+  uint8_t buf[4];
+  CHECK (parse_hex ("", buf, 4) == 0);
+  CHECK (parse_hex ("00fF10A5", buf, 4) == 4);
+  CHECK (memcmp (buf, "\x00\xff\x10\xa5", 4) == 0);
+  CHECK (parse_hex ("0102 \r", buf, 4) == 2);
+  CHECK (parse_hex ("0102030405", buf, 4) == -1);
+  CHECK (parse_hex ("012", buf, 4) == -1);
+  CHECK (parse_hex ("0 ", buf, 4) == -1);
+  CHECK (parse_hex ("01 02", buf, 4) == -1);
+  CHECK (parse_hex ("0g", buf, 4) == -1);
+  }
+
+//
+// test_parse_base64
+//
+static void test_parse_base64 (void)
+  {
+  uint8_t buf[6];
+  CHECK (parse_base64 ("", buf, 6) == 0);
+  CHECK (parse_base64 ("AQID", buf, 6) == 3);
+  CHECK (memcmp (buf, "\x01\x02\x03", 3) == 0);
+  CHECK (parse_base64 ("+/+/", buf, 6) == 3);
+  CHECK (memcmp (buf, "\xfb\xff\xbf", 3) == 0);
+  // Padding is optional, and blanks may follow it
+  CHECK (parse_base64 ("AQI=", buf, 6) == 2);
+  CHECK (parse_base64 ("AQI", buf, 6) == 2);
+  CHECK (parse_base64 ("AQ== \r", buf, 6) == 1);
+  CHECK (buf[0] == 1);
+  // A single leftover character isn't a byte
+  CHECK (parse_base64 ("AQIDB", buf, 6) == -1);
+  CHECK (parse_base64 ("A===", buf, 6) == -1);
+  CHECK (parse_base64 ("AQ=x", buf, 6) == -1);
+  CHECK (parse_base64 ("AQ I", buf, 6) == -1);
+  CHECK (parse_base64 ("AQ!D", buf, 6) == -1);
+  CHECK (parse_base64 ("AQIDBAUG", buf, 6) == 6);
+  CHECK (parse_base64 ("AQIDBAUGBw", buf, 6) == -1);
+  }
+
+//
+// test_crc16
+//
+// CRC-16/CCITT-FALSE, computed all at once or in pieces
+//
+static void test_crc16 (void)
+  {
+  const uint8_t *check = (const uint8_t *)"123456789";
+  CHECK (frame_crc16 (0xFFFF, check, 9) == 0x29B1);
+  CHECK (frame_crc16 (frame_crc16 (0xFFFF, check, 4), check + 4, 5)
+    == 0x29B1);
+  CHECK (frame_crc16 (0xFFFF, check, 0) == 0xFFFF);
+  }
+
+//
+// delta_ok
+//
+// Check a DELTA payload with the given header and codes
+//
+static BOOL delta_ok (int module, int n, const uint8_t *codes, int len)
+  {
+  uint8_t payload[64];
+  payload[0] = module & 0xFF;
+  payload[1] = module >> 8;
+  payload[2] = n & 0xFF;
+  payload[3] = n >> 8;
+  memcpy (payload + 4, codes, len);
+  return frame_check_delta (payload, 4 + len);
+  }
+
+//
+// test_delta
+//
+// DELTA payloads are rejected if the header is short or out of range,
+// or the codes run beyond the payload or the difference
+//
+static void test_delta (void)
+  {
+  // Skip 3, repeat 0xFF 4 times, literal 2 bytes: 9 bytes of a module
+  const uint8_t codes[] = { FRAME_DELTA_SKIP + 2, FRAME_DELTA_REPEAT + 3,
+    0xFF, FRAME_DELTA_LITERAL + 1, 0x12, 0x34 };
+  CHECK (delta_ok (0, 2, codes, sizeof (codes)));
+  CHECK (delta_ok (0, 1, codes, 0));
+  // Exactly filling the difference is allowed, going past it isn't
+  const uint8_t fill[] = { FRAME_DELTA_SKIP + 7 };
+  CHECK (delta_ok (0, 1, fill, sizeof (fill)));
+  CHECK (!delta_ok (0, 1, codes, sizeof (codes)));
+  const uint8_t skip_all[] = { FRAME_DELTA_SKIP + 127, FRAME_DELTA_SKIP };
+  CHECK (delta_ok (0, 16, skip_all, 1));
+  CHECK (!delta_ok (0, 16, skip_all, 2));
+  // Truncated codes
+  CHECK (!delta_ok (0, 2, codes, 2));
+  CHECK (!delta_ok (0, 2, codes, sizeof (codes) - 1));
+  // Bad headers
+  CHECK (!delta_ok (0, 0, codes, 0));
+  CHECK (delta_ok (PICO7219_MAX_VCHAIN - 1, 1, codes, 0));
+  CHECK (!delta_ok (PICO7219_MAX_VCHAIN - 1, 2, codes, 0));
+  const uint8_t header[] = { 0, 0, 1 };
+  CHECK (!frame_check_delta (header, sizeof (header)));
+  }
+
+//
+// Start here
+//
+int main (void)
+  {
+  test_parse_int ();
+  test_parse_ints ();
+  test_parse_hex ();
+  test_parse_base64 ();
+  test_crc16 ();
+  test_delta ();
+  if (failures)
+    {
+    fprintf (stderr, "%d check(s) failed\n", failures);
+    return 1;
+    }
+  printf ("All tests passed\n");
+  return 0;
+  }
+
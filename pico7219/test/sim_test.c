@@ -0,0 +1,591 @@
+/*=========================================================================
+
+  Pico7219
+
+  sim_test.c
+
+  Tests of the Pico7219 library, run against the simulated MAX7219
+  chain, so they need no hardware. Each test draws something, flushes
+  it, and checks what the simulated modules' registers hold, and how
+  much was sent to get it there. The drawing functions are checked 
+  against a reference image that is drawn one pixel at a time, using
+  random arguments from a fixed seed, so every run is the same. Built
+  and run by ctest in the host build.
+
+  Copyright (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico7219/pico7219.h"
+#include "pico7219/pico7219_backend.h"
+
+// Modules in the simulated chain
+#define TEST_CHAIN 4
+
+// Columns of the physical display
+#define TEST_COLS (PICO7219_COLS * TEST_CHAIN)
+
+// The most columns of virtual chain that a reference image can hold
+#define REF_COLS (PICO7219_COLS * 16)
+
+// Number of random operations in each of the randomized tests
+#define TEST_OPS 2000
+
+// Number of checks that have failed
+static int failures = 0;
+
+#define CHECK(cond) \
+  do { if (!(cond)) { \
+    fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+      #cond); \
+    failures++; } } while (0)
+
+//
+// test_create
+//
+// Create a display instance driving a simulated chain
+//
+static struct Pico7219 *test_create (struct Pico7219Backend **backend)
+  {
+  *backend = pico7219_sim_backend_create (TEST_CHAIN, 0, FALSE);
+  if (!*backend) return NULL;
+  return pico7219_create_with_backend (*backend, TEST_CHAIN, FALSE);
+  }
+
+//
+// pixel
+//
+// Get the state of the LED at row, col of the physical display, as
+// the simulated chain's registers have it
+//
+static int pixel (const struct Pico7219Backend *backend, int row, int col)
+  {
+  uint8_t reg = pico7219_sim_get_register (backend,
+    col / PICO7219_COLS, row + 1);
+  return (reg >> (col % PICO7219_COLS)) & 1;
+  }
+
+//
+// count_pixels
+//
+// Get the number of LEDs that are on
+//
+static int count_pixels (const struct Pico7219Backend *backend)
+  {
+  int n = 0;
+  for (int row = 0; row < PICO7219_ROWS; row++)
+    for (int col = 0; col < PICO7219_COLS * TEST_CHAIN; col++)
+      n += pixel (backend, row, col);
+  return n;
+  }
+
+//
+// random_int
+//
+// Get a random number from lo to hi - 1
+//
+static int random_int (int lo, int hi)
+  {
+  return lo + rand() % (hi - lo);
+  }
+
+//
+// check_window
+//
+// Check that the display shows the part of a reference image of a 
+// virtual chain "width" columns wide that starts at column "offset", 
+// wrapping round at the end. Only the first mismatch is reported.
+//
+static void check_window (const struct Pico7219Backend *backend,
+        uint8_t ref[PICO7219_ROWS][REF_COLS], int width, int offset)
+  {
+  int shown = width < TEST_COLS ? width : TEST_COLS;
+  for (int row = 0; row < PICO7219_ROWS; row++)
+    for (int col = 0; col < TEST_COLS; col++)
+      {
+      int want = col < shown ? ref[row][(offset + col) % width] : 0;
+      if (pixel (backend, row, col) != want)
+        {
+        fprintf (stderr, "row %d col %d: want %d\n", row, col, want);
+        CHECK (pixel (backend, row, col) == want);
+        return;
+        }
+      }
+  }
+
+//
+// check_display
+//
+// Check that the display shows exactly a reference image of the 
+// physical chain
+//
+static void check_display (const struct Pico7219Backend *backend,
+        uint8_t ref[PICO7219_ROWS][REF_COLS])
+  {
+  check_window (backend, ref, TEST_COLS, 0);
+  }
+
+//
+// test_flush
+//
+// One LED, flushed, ends up in the right register, and flushing again
+// with nothing changed sends nothing.
+//
+static void test_flush (void)
+  {
+  struct Pico7219Backend *b;
+  struct Pico7219 *p = test_create (&b);
+  CHECK (p != NULL);
+  if (!p) return;
+  pico7219_flush (p);
+  pico7219_sim_reset_stats (b);
+
+  pico7219_switch_on (p, 2, 10, FALSE);
+  pico7219_flush (p);
+  CHECK (pixel (b, 2, 10));
+  CHECK (count_pixels (b) == 1);
+  struct Pico7219SimStats stats;
+  pico7219_sim_get_stats (b, &stats);
+  // One row changed, in one module
+  CHECK (stats.register_writes == 1);
+  CHECK (stats.transactions == 1);
+
+  pico7219_sim_reset_stats (b);
+  pico7219_flush (p);
+  pico7219_sim_get_stats (b, &stats);
+  CHECK (stats.bytes == 0);
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// test_scroll
+//
+// Scrolling a virtual chain longer than the display moves the window,
+// and wraps round at the end.
+//
+static void test_scroll (void)
+  {
+  struct Pico7219Backend *b;
+  struct Pico7219 *p = test_create (&b);
+  CHECK (p != NULL);
+  if (!p) return;
+  pico7219_set_virtual_chain_length (p, 2 * TEST_CHAIN);
+  pico7219_switch_on (p, 5, 40, FALSE);
+  pico7219_flush (p);
+  CHECK (count_pixels (b) == 0);
+
+  pico7219_set_scroll_offset (p, 33);
+  pico7219_flush (p);
+  CHECK (pixel (b, 5, 7));
+  CHECK (count_pixels (b) == 1);
+
+  // All the way round, and one more
+  for (int i = 0; i < PICO7219_COLS * 2 * TEST_CHAIN; i++)
+    pico7219_scroll (p, TRUE);
+  pico7219_flush (p);
+  CHECK (pico7219_get_scroll_offset (p) == 33);
+  CHECK (pixel (b, 5, 7));
+  pico7219_scroll (p, TRUE);
+  pico7219_flush (p);
+  CHECK (pixel (b, 5, 6));
+  CHECK (count_pixels (b) == 1);
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// test_empty_chain
+//
+// A virtual chain of length zero can be scrolled and flushed
+//
+static void test_empty_chain (void)
+  {
+  struct Pico7219Backend *b;
+  struct Pico7219 *p = test_create (&b);
+  CHECK (p != NULL);
+  if (!p) return;
+  pico7219_set_virtual_chain_length (p, 0);
+  pico7219_set_scroll_offset (p, 5);
+  CHECK (pico7219_get_scroll_offset (p) == 0);
+  pico7219_scroll (p, TRUE);
+  pico7219_flush (p);
+  CHECK (count_pixels (b) == 0);
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// test_blit
+//
+// Glyphs in either bit order land in the right columns, spill over 
+// into the next module, are cut off at the end of the chain, and are
+// ORed with what is already there
+//
+static void test_blit (void)
+  {
+  struct Pico7219Backend *b;
+  struct Pico7219 *p = test_create (&b);
+  CHECK (p != NULL);
+  if (!p) return;
+  static uint8_t ref[PICO7219_ROWS][REF_COLS];
+  memset (ref, 0, sizeof (ref));
+  srand (1);
+  for (int op = 0; op < TEST_OPS; op++)
+    {
+    if (op % 16 == 0)
+      {
+      pico7219_switch_off_all (p, FALSE);
+      memset (ref, 0, sizeof (ref));
+      }
+    uint8_t bits[PICO7219_ROWS];
+    int col = random_int (0, TEST_COLS);
+    BOOL msb_first = rand() % 2;
+    for (int row = 0; row < PICO7219_ROWS; row++)
+      {
+      bits[row] = rand();
+      for (int k = 0; k < PICO7219_COLS; k++)
+        {
+        int bit = msb_first ? (bits[row] >> (7 - k)) & 1 
+          : (bits[row] >> k) & 1;
+        if (bit && col + k < TEST_COLS) ref[row][col + k] = 1;
+        }
+      }
+    pico7219_blit (p, col, bits, msb_first, TRUE);
+    check_display (b, ref);
+    }
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// test_hline
+//
+// Lines and rectangles, switched on and off, set exactly the columns 
+// they cover, including the partial bytes at each end, and are cut off
+// at the edges of the chain
+//
+static void test_hline (void)
+  {
+  struct Pico7219Backend *b;
+  struct Pico7219 *p = test_create (&b);
+  CHECK (p != NULL);
+  if (!p) return;
+  static uint8_t ref[PICO7219_ROWS][REF_COLS];
+  memset (ref, 0, sizeof (ref));
+  srand (2);
+  for (int op = 0; op < TEST_OPS; op++)
+    {
+    BOOL on = rand() % 2;
+    int col = random_int (-10, TEST_COLS + 10);
+    int width = random_int (-2, TEST_COLS + 4);
+    int row = random_int (-3, PICO7219_ROWS + 2);
+    int height = rand() % 2 ? 1 : random_int (0, PICO7219_ROWS + 2);
+    if (height == 1 && row >= 0 && row < PICO7219_ROWS)
+      pico7219_hline (p, row, col, width, on, TRUE);
+    else
+      pico7219_fill_rect (p, row, col, height, width, on, TRUE);
+    for (int r = row; r < row + height; r++)
+      for (int c = col; c < col + width; c++)
+        if (r >= 0 && r < PICO7219_ROWS && c >= 0 && c < TEST_COLS)
+          ref[r][c] = on;
+    check_display (b, ref);
+    }
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// test_set_columns
+//
+// Runs of columns, which may start before the chain or run off its 
+// end, are transposed into the rows, leaving the columns either side
+// alone
+//
+static void test_set_columns (void)
+  {
+  struct Pico7219Backend *b;
+  struct Pico7219 *p = test_create (&b);
+  CHECK (p != NULL);
+  if (!p) return;
+  static uint8_t ref[PICO7219_ROWS][REF_COLS];
+  memset (ref, 0, sizeof (ref));
+  srand (3);
+  for (int op = 0; op < TEST_OPS; op++)
+    {
+    uint8_t cols[24];
+    int col = random_int (-12, TEST_COLS + 4);
+    int n = random_int (0, sizeof (cols));
+    for (int i = 0; i < n; i++)
+      {
+      cols[i] = rand();
+      for (int row = 0; row < PICO7219_ROWS; row++)
+        if (col + i >= 0 && col + i < TEST_COLS)
+          ref[row][col + i] = (cols[i] >> row) & 1;
+      }
+    pico7219_set_columns (p, col, cols, n, TRUE);
+    check_display (b, ref);
+    }
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// test_xor
+//
+// XORing bytes into a row toggles just those LEDs, and bytes beyond 
+// the end of the chain are ignored
+//
+static void test_xor (void)
+  {
+  struct Pico7219Backend *b;
+  struct Pico7219 *p = test_create (&b);
+  CHECK (p != NULL);
+  if (!p) return;
+  static uint8_t ref[PICO7219_ROWS][REF_COLS];
+  memset (ref, 0, sizeof (ref));
+  srand (4);
+  for (int op = 0; op < TEST_OPS; op++)
+    {
+    uint8_t bits[TEST_CHAIN + 2];
+    int row = random_int (0, PICO7219_ROWS);
+    int module = random_int (0, TEST_CHAIN + 1);
+    int n = random_int (0, sizeof (bits));
+    for (int i = 0; i < n; i++)
+      {
+      bits[i] = rand();
+      for (int k = 0; k < PICO7219_COLS; k++)
+        {
+        int col = PICO7219_COLS * (module + i) + k;
+        if (col < TEST_COLS) ref[row][col] ^= (bits[i] >> k) & 1;
+        }
+      }
+    pico7219_xor_vrow_bytes (p, row, module, bits, n, TRUE);
+    check_display (b, ref);
+    }
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// test_grow
+//
+// Lengthening the virtual chain a module at a time, which reallocates
+// it, and spreads the rows out to a new stride, keeps what has already 
+// been drawn
+//
+static void test_grow (void)
+  {
+  struct Pico7219Backend *b;
+  struct Pico7219 *p = test_create (&b);
+  CHECK (p != NULL);
+  if (!p) return;
+  static uint8_t ref[PICO7219_ROWS][REF_COLS];
+  memset (ref, 0, sizeof (ref));
+  srand (5);
+  pico7219_reset_virtual_chain (p, 1);
+  for (int len = 1; len <= REF_COLS / PICO7219_COLS; len++)
+    {
+    CHECK (pico7219_grow_virtual_chain (p, len));
+    CHECK (pico7219_get_virtual_chain_length (p) == len);
+    // Fill the new module
+    for (int row = 0; row < PICO7219_ROWS; row++)
+      {
+      uint8_t v = rand();
+      pico7219_set_vrow_bytes (p, row, len - 1, &v, 1, FALSE);
+      for (int k = 0; k < PICO7219_COLS; k++)
+        ref[row][PICO7219_COLS * (len - 1) + k] = (v >> k) & 1;
+      }
+    // Look at the whole chain, a display's width at a time
+    int width = PICO7219_COLS * len;
+    for (int offset = 0; offset < width; offset += TEST_COLS)
+      {
+      pico7219_set_scroll_offset (p, offset);
+      pico7219_flush (p);
+      check_window (b, ref, width, offset);
+      }
+    }
+  CHECK (!pico7219_grow_virtual_chain (p, PICO7219_MAX_VCHAIN + 1));
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// test_commit
+//
+// When double-buffered, nothing drawn is shown until it is committed,
+// even if there are flushes in between, and then all of it is. A 
+// commit sends only the rows that have changed. Turning 
+// double-buffering off carries on with what is shown.
+//
+static void test_commit (void)
+  {
+  struct Pico7219Backend *b;
+  struct Pico7219 *p = test_create (&b);
+  CHECK (p != NULL);
+  if (!p) return;
+  static uint8_t shown[PICO7219_ROWS][REF_COLS];
+  static uint8_t drawn[PICO7219_ROWS][REF_COLS];
+  memset (shown, 0, sizeof (shown));
+  memset (drawn, 0, sizeof (drawn));
+  pico7219_set_double_buffered (p, TRUE);
+  srand (6);
+  for (int op = 0; op < TEST_OPS; op++)
+    {
+    int row = random_int (0, PICO7219_ROWS);
+    int col = random_int (0, TEST_COLS);
+    switch (rand() % 4)
+      {
+      case 0:
+        pico7219_switch_on (p, row, col, FALSE);
+        drawn[row][col] = 1;
+        break;
+      case 1:
+        pico7219_switch_off (p, row, col, FALSE);
+        drawn[row][col] = 0;
+        break;
+      case 2:
+        pico7219_flush (p);
+        check_display (b, shown);
+        break;
+      case 3:
+        pico7219_commit (p, rand() % 2);
+        pico7219_flush (p);
+        memcpy (shown, drawn, sizeof (shown));
+        check_display (b, shown);
+        break;
+      }
+    }
+
+  // A change to one row of the back buffer costs one row
+  pico7219_commit (p, TRUE);
+  pico7219_flush (p);
+  memcpy (shown, drawn, sizeof (shown));
+  pico7219_switch_on (p, 3, 1, FALSE);
+  pico7219_switch_on (p, 3, 30, FALSE);
+  drawn[3][1] = drawn[3][30] = 1;
+  pico7219_sim_reset_stats (b);
+  pico7219_commit (p, TRUE);
+  pico7219_flush (p);
+  struct Pico7219SimStats stats;
+  pico7219_sim_get_stats (b, &stats);
+  CHECK (stats.transactions == 1);
+  memcpy (shown, drawn, sizeof (shown));
+  check_display (b, shown);
+
+  // Uncommitted changes are lost when double-buffering is turned off
+  pico7219_switch_on (p, 5, 5, FALSE);
+  pico7219_set_double_buffered (p, FALSE);
+  pico7219_switch_on (p, 6, 6, TRUE);
+  shown[6][6] = 1;
+  check_display (b, shown);
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// test_vscroll
+//
+// Vertical scrolling rotates the rows, in either direction
+//
+static void test_vscroll (void)
+  {
+  struct Pico7219Backend *b;
+  struct Pico7219 *p = test_create (&b);
+  CHECK (p != NULL);
+  if (!p) return;
+  static uint8_t ref[PICO7219_ROWS][REF_COLS];
+  static uint8_t rotated[PICO7219_ROWS][REF_COLS];
+  srand (7);
+  for (int row = 0; row < PICO7219_ROWS; row++)
+    for (int col = 0; col < TEST_COLS; col++)
+      {
+      ref[row][col] = rand() % 2;
+      if (ref[row][col]) pico7219_switch_on (p, row, col, FALSE);
+      }
+  for (int offset = -PICO7219_ROWS; offset <= 2 * PICO7219_ROWS; offset++)
+    {
+    pico7219_set_vscroll_offset (p, offset);
+    pico7219_flush (p);
+    int v = (offset + 2 * PICO7219_ROWS) % PICO7219_ROWS;
+    CHECK (pico7219_get_vscroll_offset (p) == v);
+    for (int row = 0; row < PICO7219_ROWS; row++)
+      memcpy (rotated[row], ref[(row + v) % PICO7219_ROWS], REF_COLS);
+    check_display (b, rotated);
+    }
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// test_roll
+//
+// A roll brings the new contents in from the bottom, one row per step,
+// pushing the old ones up, and ends with the new contents displayed
+//
+static void test_roll (void)
+  {
+  struct Pico7219Backend *b;
+  struct Pico7219 *p = test_create (&b);
+  CHECK (p != NULL);
+  if (!p) return;
+  static uint8_t old[PICO7219_ROWS][REF_COLS];
+  static uint8_t new[PICO7219_ROWS][REF_COLS];
+  static uint8_t want[PICO7219_ROWS][REF_COLS];
+  srand (8);
+  pico7219_set_double_buffered (p, TRUE);
+  for (int row = 0; row < PICO7219_ROWS; row++)
+    for (int col = 0; col < TEST_COLS; col++)
+      {
+      old[row][col] = rand() % 2;
+      if (old[row][col]) pico7219_switch_on (p, row, col, FALSE);
+      }
+  pico7219_commit (p, FALSE);
+  pico7219_flush (p);
+  check_display (b, old);
+
+  pico7219_begin_roll (p);
+  pico7219_switch_off_all (p, FALSE);
+  for (int row = 0; row < PICO7219_ROWS; row++)
+    for (int col = 0; col < TEST_COLS; col++)
+      {
+      new[row][col] = rand() % 2;
+      if (new[row][col]) pico7219_switch_on (p, row, col, FALSE);
+      }
+  pico7219_commit (p, FALSE);
+  // Nothing moves until the first step
+  pico7219_flush (p);
+  check_display (b, old);
+  for (int step = 1; step <= PICO7219_ROWS; step++)
+    {
+    BOOL more = pico7219_roll_step (p);
+    CHECK (more == (step < PICO7219_ROWS));
+    pico7219_flush (p);
+    for (int row = 0; row < PICO7219_ROWS; row++)
+      memcpy (want[row], row >= step ? old[row - step] 
+        : new[row + PICO7219_ROWS - step], REF_COLS);
+    check_display (b, want);
+    }
+  CHECK (!pico7219_roll_step (p));
+  check_display (b, new);
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// Start here
+//
+int main (void)
+  {
+  test_flush ();
+  test_scroll ();
+  test_empty_chain ();
+  test_blit ();
+  test_hline ();
+  test_set_columns ();
+  test_xor ();
+  test_grow ();
+  test_commit ();
+  test_vscroll ();
+  test_roll ();
+  if (failures)
+    {
+    fprintf (stderr, "%d check(s) failed\n", failures);
+    return 1;
+    }
+  printf ("All tests passed\n");
+  return 0;
+  }
+
@@ -0,0 +1,209 @@
+/*=========================================================================
+
+  Pico7219usb
+
+  bench.c
+
+  Benchmarks for the display library and the text renderer. See
+  bench.h for details.
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#include <pico7219/pico7219.h>
+#include <pico7219/pico7219_backend.h>
+#include <pico/stdlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "prog/bench.h"
+#include "prog/render.h"
+
+// The largest message used for the text benchmark
+#define BENCH_MAX_MESSAGE 128
+
+// A backend that just counts what it's sent, so that the benchmarks
+//   measure the library, rather than the SPI or a simulation.
+typedef struct _BenchBackend
+  {
+  struct Pico7219Backend backend; // Must be first
+  uint32_t bytes;
+  } BenchBackend;
+
+static void bench_backend_write (struct Pico7219Backend *backend,
+        const uint8_t *buf, int len)
+  {
+  (void)buf;
+  ((BenchBackend *)backend)->bytes += len;
+  }
+
+static void bench_backend_destroy (struct Pico7219Backend *backend,
+        BOOL deinit)
+  {
+  (void)deinit;
+  free (backend);
+  }
+
+//
+// bench_create
+//
+// Create a display instance with a counting backend, and a virtual chain
+// of the given length. Returns NULL if out of memory.
+//
+static Pico7219 *bench_create (int chain_len, int vchain_len,
+       BenchBackend **backend)
+  {
+  BenchBackend *b = malloc (sizeof (BenchBackend));
+  if (!b) return NULL;
+  b->backend.write = bench_backend_write;
+  b->backend.write_async = NULL;
+  b->backend.destroy = bench_backend_destroy;
+  b->bytes = 0;
+  *backend = b;
+  Pico7219 *p = pico7219_create_with_backend (&b->backend, chain_len, FALSE);
+  if (p) pico7219_set_virtual_chain_length (p, vchain_len);
+  return p;
+  }
+
+//
+// bench_fill
+//
+// Fill the virtual chain with a pattern that changes from module to
+// module, so that every scroll step changes every module
+//
+static void bench_fill (Pico7219 *p, int vchain_len)
+  {
+  uint8_t bits [16];
+  for (int row = 0; row < PICO7219_ROWS; row++)
+    {
+    for (int m = 0; m < vchain_len; m += sizeof (bits))
+      {
+      int n = vchain_len - m;
+      if (n > (int)sizeof (bits)) n = sizeof (bits);
+      for (int i = 0; i < n; i++)
+        bits[i] = (uint8_t)(0x5A ^ (row * 37) ^ ((m + i) * 11));
+      pico7219_set_vrow_bytes (p, row, m, bits, n, FALSE);
+      }
+    }
+  }
+
+//
+// bench_report
+//
+// See bench.h
+//
+void bench_report (const char *prefix, const char *name,
+       const char *params, uint64_t total_us, uint32_t total_bytes, int n)
+  {
+  if (total_us == 0) total_us = 1;
+  unsigned long ns = (unsigned long)(total_us * 1000 / n);
+  unsigned long fps = (unsigned long)((uint64_t)n * 1000000 / total_us);
+  printf ("%s%s%s%s ns=%lu bytes=%lu fps=%lu\n", prefix, name, 
+    *params ? " " : "", params, ns, (unsigned long)(total_bytes / n), fps);
+  }
+
+//
+// bench_scroll
+//
+// Time wrapped scrolling, one pixel at a time, including the flush
+//
+static void bench_scroll (const char *prefix, int chain_len, int vchain_len)
+  {
+  BenchBackend *b;
+  Pico7219 *p = bench_create (chain_len, vchain_len, &b);
+  if (!p) return;
+  bench_fill (p, vchain_len);
+  pico7219_flush (p);
+  b->bytes = 0;
+  int n = 0;
+  uint64_t start = time_us_64(), elapsed;
+  do
+    {
+    pico7219_scroll (p, TRUE);
+    n++;
+    } while ((elapsed = time_us_64() - start) < BENCH_MIN_US);
+  char params [40];
+  snprintf (params, sizeof (params), "chain=%d vchain=%d", chain_len,
+    vchain_len);
+  bench_report (prefix, "scroll", params, elapsed, b->bytes, n);
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// bench_flush
+//
+// Time a flush that has to rewrite every row of every module
+//
+static void bench_flush (const char *prefix, int chain_len, int vchain_len)
+  {
+  BenchBackend *b;
+  Pico7219 *p = bench_create (chain_len, vchain_len, &b);
+  if (!p) return;
+  bench_fill (p, vchain_len);
+  b->bytes = 0;
+  int n = 0;
+  uint64_t start = time_us_64(), elapsed;
+  do
+    {
+    pico7219_invalidate (p);
+    pico7219_flush (p);
+    n++;
+    } while ((elapsed = time_us_64() - start) < BENCH_MIN_US);
+  char params [40];
+  snprintf (params, sizeof (params), "chain=%d vchain=%d", chain_len,
+    vchain_len);
+  bench_report (prefix, "flush", params, elapsed, b->bytes, n);
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// bench_text
+//
+// Time the drawing of a message of len characters into the virtual
+// chain. Nothing is sent to the display.
+//
+static void bench_text (const char *prefix, int len)
+  {
+  char message [BENCH_MAX_MESSAGE + 1];
+  for (int i = 0; i < len; i++)
+    message[i] = 'A' + i % 26;
+  message[len] = 0;
+  BenchBackend *b;
+  Pico7219 *p = bench_create (PICO7219_MAX_CHAIN, len * 6 / 8 + 1, &b);
+  if (!p) return;
+  b->bytes = 0;
+  int n = 0;
+  uint64_t start = time_us_64(), elapsed;
+  do
+    {
+    render_text (p, message, 0);
+    n++;
+    } while ((elapsed = time_us_64() - start) < BENCH_MIN_US);
+  char params [40];
+  snprintf (params, sizeof (params), "len=%d", len);
+  bench_report (prefix, "text", params, elapsed, b->bytes, n);
+  pico7219_destroy (p, FALSE);
+  }
+
+//
+// bench_display
+//
+// See bench.h
+//
+void bench_display (const char *prefix)
+  {
+  static const int chains[] = { 1, 4, PICO7219_MAX_CHAIN };
+  static const int vchains[] = { 16, 64, 256, PICO7219_MAX_VCHAIN };
+  static const int lengths[] = { 8, 32, BENCH_MAX_MESSAGE };
+  for (unsigned c = 0; c < sizeof (chains) / sizeof (chains[0]); c++)
+    {
+    int chain_len = chains[c];
+    bench_flush (prefix, chain_len, chain_len);
+    bench_scroll (prefix, chain_len, chain_len);
+    for (unsigned v = 0; v < sizeof (vchains) / sizeof (vchains[0]); v++)
+      bench_scroll (prefix, chain_len, vchains[v]);
+    }
+  for (unsigned l = 0; l < sizeof (lengths) / sizeof (lengths[0]); l++)
+    bench_text (prefix, lengths[l]);
+  }
+
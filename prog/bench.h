@@ -0,0 +1,49 @@
+/*=========================================================================
+
+  Pico7219usb
+
+  bench.h
+
+  Benchmarks for the display library and the text renderer. These run
+  on private Pico7219 instances, whose backend just counts what it's
+  sent, so they don't disturb the display, and they measure the CPU
+  cost of each operation, not the time the SPI takes to send it. The
+  same code runs in the host build, in the pico7219bench program, and
+  on the Pico, in response to the CMD_BENCH command.
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#pragma once
+
+#include <stdint.h>
+
+// Minimum time to spend on each measurement, in microseconds. Each
+//   operation is repeated until at least this much time has passed, so
+//   the timer's one-microsecond resolution doesn't matter.
+#define BENCH_MIN_US 20000
+
+//
+// bench_display
+//
+// Run the display benchmarks, for a range of physical chain lengths,
+// virtual chain lengths and message lengths, printing one line of
+// results for each. Each line starts with prefix, followed by the
+// name of the operation, the parameters, and then the results:
+//
+// ns=     time in nanoseconds for each frame (or string, for text)
+// bytes=  SPI bytes for each frame
+// fps=    the number of frames per second that this time allows
+//
+void bench_display (const char *prefix);
+
+//
+// bench_report
+//
+// Print a line of results in the same format as bench_display(). total_us
+// is the time taken by n operations, which between them sent total_bytes
+// SPI bytes.
+//
+void bench_report (const char *prefix, const char *name,
+       const char *params, uint64_t total_us, uint32_t total_bytes, int n);
+
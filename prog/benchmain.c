@@ -0,0 +1,20 @@
+/*=========================================================================
+ 
+  Pico7219usb
+
+  benchmain.c
+
+  The main program for pico7219bench, which runs the display benchmarks
+  from bench.c in a host build, and prints the results. 
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#include "prog/bench.h"
+
+int main (void)
+  {
+  bench_display ("");
+  return 0;
+  }
+
@@ -64,6 +64,29 @@ void buffer_append (Buffer *self, char c)
     }
   }
 
+// 
+// buffer_append_span
+//
+int buffer_append_span (Buffer *self, const char *s, int len)
+  {
+  int room = self->length - 1 - self->pos;
+  int copied = len < room ? len : room;
+  memcpy (self->c_str + self->pos, s, copied);
+  int n = copied;
+  // CRs are rare, so only go through the characters one by one if 
+  //   there is one 
+  if (memchr (self->c_str + self->pos, 13, copied))
+    {
+    int j = self->pos;
+    for (int i = self->pos; i < self->pos + copied; i++)
+      if (self->c_str[i] != 13) self->c_str[j++] = self->c_str[i];
+    n = j - self->pos;
+    }
+  self->pos += n;
+  self->c_str [self->pos] = 0;
+  return len - copied;
+  }
+
 // 
 // buffer_reset
 //
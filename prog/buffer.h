@@ -46,6 +46,15 @@ void    buffer_destroy (Buffer *self);
 //
 void buffer_append (Buffer *self, char c);
  
+// 
+// buffer_append_span
+//
+// Append len characters to the buffer, leaving out any CR characters.
+// As many characters as will fit are appended, and the number that
+// had to be dropped is returned.
+//
+int buffer_append_span (Buffer *self, const char *s, int len);
+ 
 // 
 // buffer_reset
 //
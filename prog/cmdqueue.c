@@ -0,0 +1,86 @@
+/*=========================================================================
+ 
+  Pico7219usb
+
+  cmdqueue.c
+
+  Implements a lock-free queue of display commands between the two
+  cores. See cmdqueue.h for details.
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+
+#include <stddef.h>
+#include "prog/cmdqueue.h"
+
+#if PICO_ON_DEVICE
+#include "hardware/sync.h"
+#define CMDQUEUE_BARRIER() __dmb()
+#define CMDQUEUE_WAKE() __sev()
+#else
+#define CMDQUEUE_BARRIER() __sync_synchronize()
+#define CMDQUEUE_WAKE()
+#endif
+
+// 
+// cmdqueue_init
+//
+void cmdqueue_init (CmdQueue *self)
+  {
+  self->head = 0;
+  self->tail = 0;
+  }
+
+// 
+// cmdqueue_claim
+//
+RenderCmd *cmdqueue_claim (CmdQueue *self)
+  {
+  uint32_t head = self->head;
+  if (head - self->tail >= CMDQUEUE_LEN) return NULL;
+  return &self->slots [head & (CMDQUEUE_LEN - 1)];
+  }
+
+// 
+// cmdqueue_publish
+//
+void cmdqueue_publish (CmdQueue *self)
+  {
+  // Make sure the slot contents are written before the consumer
+  //   can see the new head
+  CMDQUEUE_BARRIER();
+  self->head = self->head + 1;
+  CMDQUEUE_WAKE();
+  }
+
+// 
+// cmdqueue_peek
+//
+const RenderCmd *cmdqueue_peek (CmdQueue *self)
+  {
+  uint32_t tail = self->tail;
+  if (tail == self->head) return NULL;
+  CMDQUEUE_BARRIER();
+  return &self->slots [tail & (CMDQUEUE_LEN - 1)];
+  }
+
+// 
+// cmdqueue_release
+//
+void cmdqueue_release (CmdQueue *self)
+  {
+  // Make sure we've finished with the slot before the producer can
+  //   reuse it
+  CMDQUEUE_BARRIER();
+  self->tail = self->tail + 1;
+  }
+
+// 
+// cmdqueue_is_empty
+//
+int cmdqueue_is_empty (const CmdQueue *self)
+  {
+  return self->tail == self->head;
+  }
+
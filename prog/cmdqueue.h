@@ -0,0 +1,102 @@
+/*=========================================================================
+ 
+  Pico7219usb
+
+  cmdqueue.h 
+
+  A lock-free, single-producer, single-consumer ring of display commands.
+  Core 0 parses commands from the host and adds them to the queue; 
+  core 1, which owns the display, takes them off and carries them out. 
+
+  Each side only ever writes one of the two indices, so no lock is
+  needed -- just a memory barrier between filling (or emptying) a slot
+  and moving the index past it. The producer claims a slot, fills it in
+  place, and then publishes it; the consumer peeks at the oldest slot,
+  carries out the command, and then releases it. So a command is 
+  finished with by the time the queue is seen to be empty.
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include "prog/config.h"
+
+// Number of slots in the queue. Must be a power of two.
+#define CMDQUEUE_LEN 8
+
+// Largest amount of binary data that one command can carry. Bigger
+//   binary frames are split into several commands.
+#define RENDER_DATA_MAX 128
+
+typedef struct _RenderCmd
+  {
+  char cmd; // The command character or frame type, from protocol.h
+  int x; // Numeric arguments, where the command has them
+  int y;
+  int w;
+  int h;
+  int len; // Number of bytes in data
+  union
+    {
+    char text [MAX_LINE + 1]; // Text argument, where the command has one
+    uint8_t data [RENDER_DATA_MAX]; // Binary data, from a frame
+    };
+  } RenderCmd;
+
+typedef struct _CmdQueue
+  {
+  volatile uint32_t head; // Written only by the producer
+  volatile uint32_t tail; // Written only by the consumer
+  RenderCmd slots [CMDQUEUE_LEN];
+  } CmdQueue;
+
+// 
+// cmdqueue_init
+//
+// Set the queue to empty. Call before either core uses it.
+//
+void cmdqueue_init (CmdQueue *self);
+
+// 
+// cmdqueue_claim
+//
+// Producer side. Returns the next free slot, or NULL if the queue is
+// full. The slot is not visible to the consumer until it is published.
+//
+RenderCmd *cmdqueue_claim (CmdQueue *self);
+
+// 
+// cmdqueue_publish
+//
+// Producer side. Make the slot returned by cmdqueue_claim() available 
+// to the consumer. On the Pico, this also wakes the consumer's core, if
+// it is waiting for an event (__wfe()).
+//
+void cmdqueue_publish (CmdQueue *self);
+
+// 
+// cmdqueue_peek
+//
+// Consumer side. Returns the oldest published slot, or NULL if the
+// queue is empty. The slot remains owned by the consumer until it
+// is released.
+//
+const RenderCmd *cmdqueue_peek (CmdQueue *self);
+
+// 
+// cmdqueue_release
+//
+// Consumer side. Hand the slot returned by cmdqueue_peek() back to
+// the producer.
+//
+void cmdqueue_release (CmdQueue *self);
+
+// 
+// cmdqueue_is_empty
+//
+// Returns non-zero if every published command has been released.
+//
+int cmdqueue_is_empty (const CmdQueue *self);
+
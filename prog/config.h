@@ -46,12 +46,44 @@
 //  speed is very fast. 
 #define MAX_LINE 128 
 
-// Time in milliseconds to delay between scrolls, when auto-scrolling.
-// In practice, it's hard to get very fast scrolling because of the
-// amount of data that has to be transferred, and the amount of binary
-// math required. This delay is in addition to any time taked to
-// do the actual scroll-related processing
-#define SCROLL_TIME 50 
-
-
+// Number of columns in the virtual display that the A and B commands, and 
+//  binary frames, can reach. This is limited by the memory budget of the
+//  display library, PICO7219_MAX_VCHAIN, which can be set at build time.
+#define MAX_COLUMNS (PICO7219_COLS * PICO7219_MAX_VCHAIN)
+
+// Default auto-scroll speed, in pixels per second. This can be changed
+// with the SPEED command, up to SCROLL_MAX_SPEED. Scroll steps are timed
+// by a hardware timer, so this is the actual speed, however long each
+// step takes to send to the display.
+#define SCROLL_SPEED 20 
+#define SCROLL_MAX_SPEED 1000 
+
+// The largest number of pixels that one scroll step may move, when the
+// display can't keep up with the scroll speed. If the scroll falls 
+// further behind than this, the rest of the lost time is given up. 
+#define SCROLL_MAX_STEP 8
+
+// Minimum number of blank columns between the end of the text and its
+// start, when text that is too long for the display scrolls round. The
+// virtual display is a whole number of modules, so the gap can be up to
+// seven columns more than this.
+#define SCROLL_GAP 8
+
+// Time in microseconds for which bouncing text (SCROLL_MODE_BOUNCE) 
+// pauses at each end
+#define BOUNCE_PAUSE_US 1000000
+
+// Time in microseconds for which each step of a ROLL transition is 
+// displayed. The transition takes eight steps.
+#define ROLL_TIME_US 40000
+
+// Time in microseconds for which the host must stop sending before 
+// we treat it as idle. In pipelined mode, the firmware sends an 
+// acknowledgement when the host goes idle.
+#define IDLE_TIME_US 1000
+
+// Longest time in microseconds that the parser sleeps while waiting for 
+// input, before checking whether the host has gone idle. In a host 
+// build, this is also how often the renderer runs while there's no input.
+#define INPUT_WAIT_US 1000
 
@@ -0,0 +1,60 @@
+/*=========================================================================
+ 
+  Pico7219usb
+
+  frame.c
+
+  Support for the binary framed protocol. See frame.h for details.
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+
+#include "prog/frame.h"
+
+// 
+// frame_crc16
+//
+// This is the bit-by-bit algorithm. Frames are short, and a lookup 
+// table would take 512 bytes of flash for very little gain.
+//
+uint16_t frame_crc16 (uint16_t crc, const uint8_t *data, int len)
+  {
+  for (int i = 0; i < len; i++)
+    {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int j = 0; j < 8; j++)
+      {
+      if (crc & 0x8000)
+        crc = (crc << 1) ^ 0x1021;
+      else
+        crc <<= 1;
+      }
+    }
+  return crc;
+  }
+
+//
+// frame_check_delta
+//
+BOOL frame_check_delta (const uint8_t *payload, int len)
+  {
+  if (len < 4) return FALSE;
+  int module = frame_get16 (payload);
+  int n = frame_get16 (payload + 2);
+  if (n < 1 || module + n > PICO7219_MAX_VCHAIN) return FALSE;
+  int total = PICO7219_ROWS * n;
+  const uint8_t *codes = payload + 4;
+  len -= 4;
+  int pos = 0, count;
+  for (int i = 0; i < len; )
+    {
+    int code_len = frame_delta_code (codes + i, &count);
+    if (i + code_len > len) return FALSE;
+    pos += count;
+    if (pos > total) return FALSE;
+    i += code_len;
+    }
+  return TRUE;
+  }
+
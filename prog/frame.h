@@ -0,0 +1,107 @@
+/*=========================================================================
+ 
+  Pico7219usb
+
+  frame.h 
+
+  Definitions for the binary framed protocol, which can be used 
+  alongside the text protocol to send pixel data in bulk. The frame
+  types and error codes are described in protocol.h. This file 
+  describes the layout of the frames themselves.
+
+  A frame is:
+
+  FRAME_SYNC   1 byte
+  type         1 byte, one of the FRAME_xxx types in protocol.h
+  flags        1 byte, a combination of the FRAME_FLAG_xxx values
+  length       2 bytes, LSB first -- the length of the payload
+  payload      'length' bytes
+  crc          2 bytes, LSB first
+
+  The CRC is CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF),
+  calculated over everything from the type byte to the end of the
+  payload. All multi-byte values in the payload are also LSB first.
+
+  A text command can never begin with FRAME_SYNC, so the firmware 
+  knows a frame is coming if the first byte of a message is FRAME_SYNC.
+  The response to a frame is a normal text response line.
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include <pico7219/pico7219.h>
+
+#define FRAME_SYNC 0xA5
+
+// Length of the part of the frame before the payload, including the sync
+#define FRAME_HEADER_LEN 5 
+
+// Length of the CRC at the end of the frame
+#define FRAME_CRC_LEN 2
+
+// Largest payload the firmware will accept. This is enough for a bitmap 
+//  of a virtual chain that holds MAX_LINE characters.
+#define FRAME_MAX_PAYLOAD 1024
+
+// Maximum time to wait for each byte of a frame, once the sync byte
+//  has been received. If this runs out, the frame is abandoned.
+#define FRAME_BYTE_TIMEOUT_US 100000
+
+// 
+// frame_crc16
+//
+// Update a running CRC-16/CCITT-FALSE with len bytes of data. To start,
+// pass crc = 0xFFFF.
+//
+uint16_t frame_crc16 (uint16_t crc, const uint8_t *data, int len);
+
+// Codes in the payload of a DELTA frame -- see protocol.h
+#define FRAME_DELTA_SKIP    0x00
+#define FRAME_DELTA_REPEAT  0x80
+#define FRAME_DELTA_LITERAL 0xC0
+
+//
+// frame_delta_code
+//
+// Get the length in bytes of the DELTA code at p, and set *count to the
+// number of bytes of the difference that it covers.
+//
+static inline int frame_delta_code (const uint8_t *p, int *count)
+  {
+  if (p[0] < FRAME_DELTA_REPEAT)
+    {
+    *count = p[0] - FRAME_DELTA_SKIP + 1;
+    return 1;
+    }
+  if (p[0] < FRAME_DELTA_LITERAL)
+    {
+    *count = p[0] - FRAME_DELTA_REPEAT + 1;
+    return 2;
+    }
+  *count = p[0] - FRAME_DELTA_LITERAL + 1;
+  return 1 + *count;
+  }
+
+//
+// frame_check_delta
+//
+// Check the payload of a DELTA frame: the header must be complete, the 
+// modules must lie within the largest virtual display, and the codes 
+// must not run beyond the end of the payload, or of the difference. 
+// Returns FALSE if any of that isn't so.
+//
+BOOL frame_check_delta (const uint8_t *payload, int len);
+
+// 
+// frame_get16
+//
+// Get an unsigned 16-bit value, LSB first, from a payload.
+//
+static inline int frame_get16 (const uint8_t *p)
+  {
+  return p[0] | (p[1] << 8);
+  }
+
@@ -5,130 +5,169 @@
   main.c
 
   This is the main program for the Pico7218usb firmware. It includes
-  the serial input/output routines, command parser, and font
-  renderer.
+  the serial input/output routines and the command parser, which run
+  on core 0. The font renderer and display handling are in render.c,
+  and run on core 1.
 
   =========================================================================*/
 #include <pico7219/pico7219.h> 
 #include <pico/stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include "prog/bench.h" 
 #include "prog/buffer.h" 
+#include "prog/cmdqueue.h"
 #include "prog/config.h"
+#include "prog/frame.h"
+#include "prog/parse.h"
 #include "prog/protocol.h"
+#include "prog/render.h"
+#include "prog/usbrx.h"
 
-extern uint8_t font8_table[];
+// The queue of commands from this core (the parser) to the renderer
+CmdQueue cmd_queue;
 
-// Number of millisecond ticks since the last scroll operation
-int scroll_count = 0;
+// Payload and CRC of the binary frame being processed
+uint8_t frame_buffer [FRAME_MAX_PAYLOAD + FRAME_CRC_LEN];
 
-// Set to TRUE if the display should be scrolled automatically
-int scrolling = FALSE;
+// Pipelining mode -- one of the PIPELINE_xxx values from protocol.h
+int pipeline_mode = PIPELINE_OFF;
 
-typedef struct Pico7219 Pico7219; // Shorter than "struct Pico7219..."
+// TRUE if the command being processed has a sequence number, and is
+//   being handled in pipelined mode. If so, seq is its number.
+BOOL sequenced = FALSE;
+int seq = 0;
 
-// Draw a character to the display. Note that the width of the "virtual
-// display" can be much longer than the physical module chain, and
-// off-display elements can later be scrolled into view. However, it's
-// the job of the application, not the Pico7219 library, to size the virtual
-// display sufficiently to fit all the text in.
+// Number of the last sequenced command, and the number of sequenced
+//   commands that have been processed since the last acknowledgement
+int last_seq = 0;
+int unacked = 0;
+
+// Length of the text line that the renderer is displaying, so that
+//   characters added by CMD_CHAR can be checked without asking it
+int line_len = 0;
+
+// Set to TRUE to suppress responses, while benchmarking
+BOOL quiet = FALSE;
+
+void bench_commands (const char *prefix);
+BOOL queue_pixels (const uint8_t *payload, int len);
+
+#if PICO7219_STATS
+// Counts and timings kept by the parser, for CMD_STATS
+typedef struct _ParserStats
+  {
+  uint32_t errors; // Number of error responses
+  uint32_t too_long; // Number of ERR_TOOLONG responses
+  uint32_t dropped_base; // usbrx_get_overflows() when last reset
+  struct Pico7219Timer command_time; // Time to handle each command line
+  } ParserStats;
+
+ParserStats parser_stats;
+#endif
+
+//
+// wait_for_renderer
+//
+// Wait until the renderer has caught up with every queued command. In a
+// host build there's no second core, so we have to do the work here.
 //
-// chr is an offset in the font table, which corresponds to a character 
-// code, as the font table extends down to character zero. The CP437
-// character set defines printable characters in the 0-31 range, that
-// are not ASCII characters and which may, conceivably, be useful.
-void draw_character (Pico7219 *pico7219, uint8_t chr, int x_offset, 
-       BOOL flush)
+void wait_for_renderer ()
   {
-  for (int i = 0; i < 8; i++) // row
+  while (!cmdqueue_is_empty (&cmd_queue))
     {
-    // The font elements are one byte wide even though, as it's an 8x5 font,
-    //   only the top five bits of each byte are used.
-    uint8_t v = font8_table[8 * chr + i];
-    for (int j = 0; j < 8; j++) // column
-      {
-      int sel = 1 << j;
-      if (sel & v)
-        pico7219_switch_on (pico7219, 7 - i, 7- j + x_offset, FALSE);
-      }
+#if PICO_ON_DEVICE
+    tight_loop_contents();
+#else
+    render_task();
+#endif
     }
-  if (flush)
-    pico7219_flush (pico7219);
   }
 
-// Draw a string of text on the (virtual) display. This function assumes
-// that the library has already been configured to provide a virtual
-// chain of LED modules that is long enough to fit all the text onto.
-void draw_string (Pico7219 *pico7219, const char *s, BOOL flush)
+//
+// wait_for_display
+//
+// Wait until the renderer has caught up with every queued command, and
+// has finished sending the results to the display.
+//
+void wait_for_display ()
   {
-  int x = 0;
-  while (*s)
+  wait_for_renderer();
+  while (!render_is_idle())
     {
-    //draw_character (pico7219, *s - ' ', x, FALSE); 
-    draw_character (pico7219, *s, x, FALSE); 
-    s++;
-    x += 6;
+#if PICO_ON_DEVICE
+    tight_loop_contents();
+#else
+    render_task();
+#endif
     }
-  if (flush)
-    pico7219_flush (pico7219);
-  }
-
-// Get the number of horizontal pixels that a string will take. Since each
-// font element is five pixels wide, and there is one pixel between each
-// character, we just multiply the string length by 6.
-int get_string_length_pixels (const char *s)
-  {
-  return strlen (s) * 6;
-  }
-
-// Get the number of 8x8 LED modules that would be needed to accomodate the
-// string of text. That's the number of pixels divided by 8 (the module
-// width), and then one added to round up. 
-int get_string_length_modules (const char *s)
-  {
-  return get_string_length_pixels(s) / 8 + 1;
   }
 
 //
-// size_and_draw_string
+// queue_command
+//
+// Get a slot in the command queue for a command of the given type. If
+// the queue is full, wait for the renderer to make room. The caller 
+// fills in the arguments, and then calls submit_command().
 //
-// Set the virtual module length to match the number of characters
-// in the string, then draw the string.
-void size_and_draw_string (Pico7219 *pico7219, const char *string)
+RenderCmd *queue_command (char cmd)
   {
-  int slm = get_string_length_modules (string);
-  if (slm < CHAIN_LEN) slm = CHAIN_LEN;
-  if (slm > pico7219_get_virtual_chain_length (pico7219)) 
-    pico7219_set_virtual_chain_length (pico7219, slm);
-  draw_string (pico7219, string, FALSE);
+  RenderCmd *rc;
+  while ((rc = cmdqueue_claim (&cmd_queue)) == NULL)
+    {
+#if PICO_ON_DEVICE
+    tight_loop_contents();
+#else
+    render_task();
+#endif
+    }
+  rc->cmd = cmd;
+  return rc;
   }
 
-
-void size_and_turn_on (Pico7219 *pico7219, int x, int y)
+//
+// complete_command
+//
+// Wait for the renderer to carry out the commands that have been 
+// queued, so that the response to the host means that the work has 
+// been done. Sequenced commands don't wait -- we carry on reading
+// commands while the renderer works, and acknowledge them later. Nor 
+// does anything in PIPELINE_EARLY mode, where the host uses CMD_SYNC to
+// find out when the work has been done.
+//
+void complete_command ()
   {
-  int slm = x / 8 + 1;
-  if (slm < CHAIN_LEN) slm = CHAIN_LEN;
-  if (slm > pico7219_get_virtual_chain_length (pico7219)) 
-    pico7219_set_virtual_chain_length (pico7219, slm);
-  pico7219_switch_on (pico7219, y, x, FALSE);
+  if (!sequenced && pipeline_mode != PIPELINE_EARLY)
+    wait_for_renderer();
   }
 
-void size_and_turn_off (Pico7219 *pico7219, int x, int y)
+//
+// submit_command
+//
+// Hand the command to the renderer, and complete it.
+//
+void submit_command ()
   {
-  int slm = x / 8 + 1;
-  if (slm < CHAIN_LEN) slm = CHAIN_LEN;
-  if (slm > pico7219_get_virtual_chain_length (pico7219)) 
-    pico7219_set_virtual_chain_length (pico7219, slm);
-  pico7219_switch_off (pico7219, y, x, FALSE);
+  cmdqueue_publish (&cmd_queue);
+  complete_command();
   }
 
 //
 // respond_error
 //
-// Send an error response to the host
+// Send an error response to the host. An error is the only answer a 
+// sequenced command gets, so it doesn't count towards the next 
+// cumulative acknowledgement.
 //
 void respond_error (int error, const char *text)
   {
+#if PICO7219_STATS
+  if (error != ERR_NONE) parser_stats.errors++;
+  if (error == ERR_TOOLONG) parser_stats.too_long++;
+#endif
+  if (quiet) return;
+  if (sequenced)
+    printf ("@%d ", seq);
   printf ("%d ", error);
   switch (error)
     {
@@ -137,140 +176,532 @@ void respond_error (int error, const char *text)
     case ERR_ARGS: printf ("bad_arguments"); break;
     case ERR_BADCMD: printf ("bad_command"); break;
     case ERR_TOOLONG: printf ("too_long"); break;
+    case ERR_CRC: printf ("bad_crc"); break;
+    case ERR_FRAME: printf ("bad_frame"); break;
     }
   if (text) printf (" %s", text);
   printf ("\n");
   }
 
+//
+// send_ack
+//
+// Acknowledge all the sequenced commands up to last_seq, once the
+// renderer has caught up with them.
+//
+void send_ack ()
+  {
+  wait_for_renderer();
+  printf ("@%d 0 OK\n", last_seq);
+  unacked = 0;
+  }
+
 //
 // respond_ok
 //
+// Sequenced commands are not acknowledged one at a time. In PIPELINE_ACK
+// mode, a cumulative acknowledgement is sent after every PIPELINE_WINDOW
+// commands, or when the host stops sending. 
+//
 void respond_ok ()
   {
-  respond_error (ERR_NONE, NULL);
+  if (sequenced)
+    {
+    last_seq = seq;
+    unacked++;
+    if (pipeline_mode == PIPELINE_ACK && unacked >= PIPELINE_WINDOW)
+      send_ack();
+    }
+  else
+    respond_error (ERR_NONE, NULL);
+  }
+
+#if PICO7219_STATS
+//
+// format_timer
+//
+// Add a timing to the stats response, as name=min/avg/max
+//
+static int format_timer (char *buf, int size, const char *name, 
+       const struct Pico7219Timer *t)
+  {
+  return snprintf (buf, size, " %s=%lu/%lu/%lu", name, 
+    (unsigned long)t->min_us, (unsigned long)pico7219_timer_avg (t), 
+    (unsigned long)t->max_us);
+  }
+
+//
+// respond_stats
+//
+// Get the renderer's counts and timings, and send them, with the 
+// parser's own, as a single-line response. If reset is TRUE, set them
+// all back to zero.
+//
+void respond_stats (BOOL reset)
+  {
+  RenderCmd *rc = queue_command (CMD_STATS);
+  rc->x = reset;
+  cmdqueue_publish (&cmd_queue);
+  wait_for_renderer();
+  RenderStats rs;
+  render_get_stats (&rs);
+
+  char text [320];
+  int n = snprintf (text, sizeof (text), "flushes=%lu rows=%lu bytes=%lu",
+    (unsigned long)rs.display.flushes, 
+    (unsigned long)rs.display.rows_written, 
+    (unsigned long)rs.display.spi_bytes);
+  n += format_timer (text + n, sizeof (text) - n, "flush_us", 
+    &rs.display.flush_time);
+  n += format_timer (text + n, sizeof (text) - n, "scroll_us", 
+    &rs.scroll_frame);
+  n += format_timer (text + n, sizeof (text) - n, "jitter_us", 
+    &rs.scroll_jitter);
+  n += snprintf (text + n, sizeof (text) - n, " cmds=%lu", 
+    (unsigned long)parser_stats.command_time.count);
+  n += format_timer (text + n, sizeof (text) - n, "cmd_us", 
+    &parser_stats.command_time);
+  uint32_t dropped = usbrx_get_overflows();
+  snprintf (text + n, sizeof (text) - n, 
+    " errors=%lu too_long=%lu dropped=%lu", 
+    (unsigned long)parser_stats.errors, 
+    (unsigned long)parser_stats.too_long, 
+    (unsigned long)(dropped - parser_stats.dropped_base));
+  respond_error (ERR_NONE, text);
+
+  if (reset)
+    {
+    memset (&parser_stats, 0, sizeof (parser_stats));
+    parser_stats.dropped_base = dropped;
+    }
+  }
+#endif
+
+//
+// Command arguments
+//
+// Each command names one of these schemas in the command table, and
+// process_input_buffer() parses its arguments accordingly, before the
+// command's handler is called. 
+//
+#define ARGS_NONE 0 // Nothing may follow the command
+#define ARGS_INTS 1 // Between min_args and max_args comma-separated integers
+#define ARGS_TEXT 2 // The rest of the line, which must not be empty
+#define ARGS_DATA 3 // An integer, a comma, and then the rest of the line
+
+// The most integers any command can have
+#define MAX_ARGS (MAX_INPUT / 2)
+
+// All commands are upper-case letters, and the command table only has
+//   entries for those
+#define CMD_FIRST 'A'
+#define CMD_LAST 'Z'
+
+// Returned by a command handler that has sent its own response
+#define ERR_RESPONDED -1
+
+// The parsed arguments of a command
+typedef struct _CmdArgs
+  {
+  int n; // Number of integers
+  int v [MAX_ARGS]; // The integers
+  const char *text; // The text, for ARGS_TEXT and ARGS_DATA
+  } CmdArgs;
+
+// A command handler carries out command cmd, and returns ERR_NONE, if 
+//   process_input_buffer() is to respond OK, ERR_RESPONDED, or an error.
+typedef int (*CmdHandler) (char cmd, const CmdArgs *args);
+
+typedef struct _CmdEntry
+  {
+  CmdHandler handler; // NULL if there's no such command
+  uint8_t schema; // One of the ARGS_xxx values
+  uint8_t min_args; // For ARGS_INTS, the fewest and most integers
+  uint8_t max_args; 
+  int16_t lo, hi; // If lo < hi, the range of the first integer
+  } CmdEntry;
+
+//
+// parse_seq
+//
+// In pipelined mode, get the sequence number from the start of a 
+// command line, if there is one, and return the rest of the line. 
+// The number may be followed by one space. Returns NULL if the number
+// has more than MAX_DIGITS digits, or is more than PIPELINE_SEQ_MASK;
+// the line is then answered without a sequence number.
+//
+const char *parse_seq (const char *line)
+  {
+  sequenced = FALSE;
+  if (pipeline_mode == PIPELINE_OFF || pipeline_mode == PIPELINE_EARLY) 
+    return line;
+  if (*line < '0' || *line > '9') return line;
+  const char *digits = line;
+  int n = 0;
+  while (*line >= '0' && *line <= '9')
+    {
+    if (line - digits == MAX_DIGITS) return NULL;
+    n = n * 10 + (*line - '0');
+    line++;
+    }
+  if (n > PIPELINE_SEQ_MASK) return NULL;
+  if (*line == ' ') line++;
+  sequenced = TRUE;
+  seq = n;
+  return line;
+  }
+
+//
+// cmd_on_off
+//
+// CMD_ON and CMD_OFF: set or clear one pixel
+//
+static int cmd_on_off (char cmd, const CmdArgs *args)
+  {
+  if (args->v[1] < 0 || args->v[1] >= MAX_COLUMNS) return ERR_ARGS;
+  RenderCmd *rc = queue_command (cmd);
+  rc->x = args->v[0];
+  rc->y = args->v[1];
+  submit_command();
+  return ERR_NONE;
+  }
+
+//
+// cmd_pixels
+//
+// CMD_PIXELS: set or clear a list of pixels, which is queued in the same
+// way as a PIXELS frame. Pixels in rows outside the display are left 
+// out. 
+//
+static int cmd_pixels (char cmd, const CmdArgs *args)
+  {
+  (void)cmd;
+  const int *v = args->v;
+  int n = args->n;
+  if (n % 2 != 1) return ERR_ARGS;
+  uint8_t payload [1 + MAX_ARGS / 2 * 3];
+  int len = 0;
+  payload[len++] = v[0];
+  for (int i = 1; i < n; i += 2)
+    {
+    if (v[i + 1] < 0 || v[i + 1] >= MAX_COLUMNS) return ERR_ARGS;
+    if (v[i] < 0 || v[i] >= PICO7219_ROWS) continue;
+    payload[len++] = v[i + 1] & 0xFF;
+    payload[len++] = v[i + 1] >> 8;
+    payload[len++] = v[i];
+    }
+  if (!queue_pixels (payload, len)) return ERR_ARGS;
+  complete_command();
+  return ERR_NONE;
+  }
+
+//
+// cmd_rect
+//
+// CMD_HLINE, CMD_VLINE and CMD_RECT, which are all queued as a 
+// FRAME_RECT, which the renderer handles in the same way. 
+//
+static int cmd_rect (char cmd, const CmdArgs *args)
+  {
+  const int *v = args->v;
+  int h = v[3], w = v[3];
+  if (cmd == CMD_RECT) w = v[4];
+  else if (cmd == CMD_HLINE) h = 1;
+  else w = 1;
+  if (v[2] < 0 || h < 1 || w < 1 || w > MAX_COLUMNS - v[2]) 
+    return ERR_ARGS;
+  RenderCmd *rc = queue_command (FRAME_RECT);
+  rc->x = v[2];
+  rc->y = v[1];
+  rc->w = w;
+  rc->h = h;
+  rc->data[0] = v[0];
+  submit_command();
+  return ERR_NONE;
+  }
+
+//
+// cmd_columns
+//
+// CMD_COLUMNS and CMD_COLUMNS64: decode the data, and queue it, split
+// into as many commands as it needs.
+//
+static int cmd_columns (char cmd, const CmdArgs *args)
+  {
+  int col = args->v[0];
+  if (col < 0) return ERR_ARGS;
+  uint8_t cols [MAX_INPUT];
+  int n = cmd == CMD_COLUMNS 
+    ? parse_hex (args->text, cols, sizeof (cols))
+    : parse_base64 (args->text, cols, sizeof (cols));
+  if (n < 1 || n > MAX_COLUMNS - col) return ERR_ARGS;
+  for (int i = 0; i < n; i += RENDER_DATA_MAX)
+    {
+    int chunk = n - i;
+    if (chunk > RENDER_DATA_MAX) chunk = RENDER_DATA_MAX;
+    RenderCmd *rc = queue_command (CMD_COLUMNS);
+    rc->x = col + i;
+    rc->len = chunk;
+    memcpy (rc->data, cols + i, chunk);
+    cmdqueue_publish (&cmd_queue);
+    }
+  complete_command();
+  return ERR_NONE;
+  }
+
+//
+// cmd_char
+//
+// CMD_CHAR: add one character to the line
+//
+static int cmd_char (char cmd, const CmdArgs *args)
+  {
+  if (line_len >= MAX_LINE - 1) return ERR_TOOLONG;
+  line_len++;
+  RenderCmd *rc = queue_command (cmd);
+  rc->text[0] = args->text[0];
+  rc->text[1] = 0;
+  submit_command();
+  return ERR_NONE;
+  }
+
+//
+// cmd_text
+//
+// CMD_STRING, CMD_UPDATE and CMD_ROLL: replace the line
+//
+static int cmd_text (char cmd, const CmdArgs *args)
+  {
+  int len = strlen (args->text);
+  if (len >= MAX_LINE) return ERR_TOOLONG;
+  line_len = len;
+  RenderCmd *rc = queue_command (cmd);
+  memcpy (rc->text, args->text, len + 1);
+  submit_command();
+  return ERR_NONE;
+  }
+
+//
+// cmd_simple
+//
+// Commands with no arguments, that the renderer carries out
+//
+static int cmd_simple (char cmd, const CmdArgs *args)
+  {
+  (void)args;
+  if (cmd == CMD_RESET) line_len = 0;
+  queue_command (cmd);
+  submit_command();
+  return ERR_NONE;
+  }
+
+//
+// cmd_value
+//
+// Commands with a single integer, that the renderer carries out. The
+// command table sets the allowed range.
+//
+static int cmd_value (char cmd, const CmdArgs *args)
+  {
+  RenderCmd *rc = queue_command (cmd);
+  rc->x = args->v[0];
+  submit_command();
+  return ERR_NONE;
+  }
+
+//
+// cmd_brightness
+//
+// CMD_BRIGHTNESS: like cmd_value, but out-of-range values are clipped,
+// not refused.
+//
+static int cmd_brightness (char cmd, const CmdArgs *args)
+  {
+  int x = args->v[0];
+  if (x < 0) x = 0;
+  if (x > 15) x = 15;
+  RenderCmd *rc = queue_command (cmd);
+  rc->x = x;
+  submit_command();
+  return ERR_NONE;
+  }
+
+#if PICO7219_STATS
+//
+// cmd_stats
+//
+// CMD_STATS: report, and optionally reset, the counts and timings
+//
+static int cmd_stats (char cmd, const CmdArgs *args)
+  {
+  (void)cmd;
+  respond_stats (args->n == 1 && args->v[0] == 1);
+  return ERR_RESPONDED;
+  }
+#endif
+
+//
+// cmd_bench
+//
+// CMD_BENCH: run the benchmarks
+//
+static int cmd_bench (char cmd, const CmdArgs *args)
+  {
+  (void)cmd; (void)args;
+  bench_display ("# ");
+  bench_commands ("# ");
+  return ERR_NONE;
+  }
+
+//
+// cmd_sync
+//
+// CMD_SYNC: respond when the display has caught up
+//
+static int cmd_sync (char cmd, const CmdArgs *args)
+  {
+  (void)cmd; (void)args;
+  wait_for_display();
+  if (!sequenced) return ERR_NONE;
+  last_seq = seq;
+  send_ack();
+  return ERR_RESPONDED;
+  }
+
+//
+// cmd_pipeline
+//
+// CMD_PIPELINE: change the pipelining mode
+//
+static int cmd_pipeline (char cmd, const CmdArgs *args)
+  {
+  (void)cmd;
+  // This command is always acknowledged, in the form that applied
+  //  when it was sent, so it can be used to check that everything 
+  //  before it has been done.
+  if (sequenced) 
+    {
+    last_seq = seq;
+    send_ack();
+    }
+  else
+    {
+    // Sequenced commands still waiting for their acknowledgement get 
+    //  it first, or they would never get one
+    if (unacked > 0) 
+      send_ack();
+    else
+      wait_for_renderer();
+    respond_ok();
+    }
+  pipeline_mode = args->v[0];
+  unacked = 0;
+  return ERR_RESPONDED;
+  }
+
+// The command table, indexed by command letter. Each entry gives the
+//   handler, the argument schema, the fewest and most integers, and
+//   the range of the first.
+#define ENTRY(cmd) [(cmd) - CMD_FIRST]
+static const CmdEntry commands [CMD_LAST - CMD_FIRST + 1] =
+  {
+  ENTRY (CMD_ON)         = { cmd_on_off, ARGS_INTS, 2, 2, 0, 0 },
+  ENTRY (CMD_OFF)        = { cmd_on_off, ARGS_INTS, 2, 2, 0, 0 },
+  ENTRY (CMD_PIXELS)     = { cmd_pixels, ARGS_INTS, 1, MAX_ARGS - 1, 0, 1 },
+  ENTRY (CMD_HLINE)      = { cmd_rect, ARGS_INTS, 4, 4, 0, 1 },
+  ENTRY (CMD_VLINE)      = { cmd_rect, ARGS_INTS, 4, 4, 0, 1 },
+  ENTRY (CMD_RECT)       = { cmd_rect, ARGS_INTS, 5, 5, 0, 1 },
+  ENTRY (CMD_COLUMNS)    = { cmd_columns, ARGS_DATA, 0, 0, 0, 0 },
+  ENTRY (CMD_COLUMNS64)  = { cmd_columns, ARGS_DATA, 0, 0, 0, 0 },
+  ENTRY (CMD_CHAR)       = { cmd_char, ARGS_TEXT, 0, 0, 0, 0 },
+  ENTRY (CMD_STRING)     = { cmd_text, ARGS_TEXT, 0, 0, 0, 0 },
+  ENTRY (CMD_UPDATE)     = { cmd_text, ARGS_TEXT, 0, 0, 0, 0 },
+  ENTRY (CMD_ROLL)       = { cmd_text, ARGS_TEXT, 0, 0, 0, 0 },
+  ENTRY (CMD_RESET)      = { cmd_simple, ARGS_NONE, 0, 0, 0, 0 },
+  ENTRY (CMD_FLUSH)      = { cmd_simple, ARGS_NONE, 0, 0, 0, 0 },
+  ENTRY (CMD_SCROLL)     = { cmd_simple, ARGS_NONE, 0, 0, 0, 0 },
+  ENTRY (CMD_SCROLLON)   = { cmd_simple, ARGS_NONE, 0, 0, 0, 0 },
+  ENTRY (CMD_SCROLLOFF)  = { cmd_simple, ARGS_NONE, 0, 0, 0, 0 },
+  ENTRY (CMD_SCROLLMODE) = { cmd_value, ARGS_INTS, 1, 1, 0, SCROLL_MODE_MAX },
+  ENTRY (CMD_SPEED)      = { cmd_value, ARGS_INTS, 1, 1, 1, SCROLL_MAX_SPEED },
+  ENTRY (CMD_BRIGHTNESS) = { cmd_brightness, ARGS_INTS, 1, 1, 0, 0 },
+#if PICO7219_STATS
+  ENTRY (CMD_STATS)      = { cmd_stats, ARGS_INTS, 0, 1, 0, 1 },
+#endif
+  ENTRY (CMD_BENCH)      = { cmd_bench, ARGS_NONE, 0, 0, 0, 0 },
+  ENTRY (CMD_SYNC)       = { cmd_sync, ARGS_NONE, 0, 0, 0, 0 },
+  ENTRY (CMD_PIPELINE)   = { cmd_pipeline, ARGS_INTS, 1, 1, 
+                             PIPELINE_OFF, PIPELINE_EARLY },
+  };
+
+//
+// parse_args
+//
+// Parse the arguments of a command, according to its schema. Returns
+// ERR_NONE or an error.
+//
+static int parse_args (const CmdEntry *entry, const char *s, CmdArgs *args)
+  {
+  args->n = 0;
+  args->text = s;
+  switch (entry->schema)
+    {
+    case ARGS_NONE:
+      return parse_at_end (s) ? ERR_NONE : ERR_ARGS;
+
+    case ARGS_INTS:
+      args->n = parse_ints (s, args->v, entry->max_args);
+      if (args->n < entry->min_args) return ERR_ARGS;
+      if (entry->lo < entry->hi && args->n > 0
+           && (args->v[0] < entry->lo || args->v[0] > entry->hi))
+        return ERR_ARGS;
+      return ERR_NONE;
+
+    case ARGS_TEXT:
+      return *s ? ERR_NONE : ERR_TOOSHORT;
+
+    case ARGS_DATA:
+      if (!parse_int (&s, &args->v[0]) || *s != ',') return ERR_ARGS;
+      args->n = 1;
+      args->text = parse_skip_blanks (s + 1);
+      return ERR_NONE;
+    }
+  return ERR_ARGS;
   }
 
 // 
 // process_input_buffer
 //
-// This is the command parser, and the place where most of the
-// heavy lifting happens.
+// This is the command parser. The command is looked up in the command
+// table, its arguments are checked, and its handler passes it to the 
+// renderer to carry out.
 //
-void process_input_buffer (Pico7219 *pico7219, Buffer *in_buffer, 
-        Buffer *line_buffer)
+void process_input_buffer (Buffer *in_buffer)
   {
-  if (in_buffer->pos > 0)
+  // Too big to go on the stack
+  static CmdArgs args;
+  const char *line = parse_seq (in_buffer->c_str);
+  if (!line)
+    {
+    // A sequence number that is out of range
+    respond_error (ERR_ARGS, in_buffer->c_str);
+    }
+  else if (*line)
     {
-    char cmd = in_buffer->c_str[0];
-    switch (cmd)
+    char cmd = line[0];
+    const CmdEntry *entry = cmd >= CMD_FIRST && cmd <= CMD_LAST 
+      ? &commands[cmd - CMD_FIRST] : NULL;
+    int error = ERR_BADCMD;
+    if (entry && entry->handler)
       {
-      int x, y;
-      case CMD_ON:
-        if (sscanf (in_buffer->c_str + 1, "%d,%d", &x, &y) == 2)
-          {
-	  size_and_turn_on (pico7219, y, x);
-          respond_ok();
-          }
-        else 
-          {
-          respond_error (ERR_ARGS, in_buffer->c_str + 1);
-          }
-        break;
-
-      case CMD_OFF:
-        if (sscanf (in_buffer->c_str + 1, "%d,%d", &x, &y) == 2)
-          {
-	  size_and_turn_off (pico7219, y, x);
-          respond_ok();
-          }
-        else 
-          {
-          respond_error (ERR_ARGS, in_buffer->c_str + 1);
-          }
-        break;
-
-      case CMD_FLUSH:
-        pico7219_flush (pico7219);
-        respond_ok();
-        break;
-
-      case CMD_CHAR:
-        if (in_buffer->length >= 2)
-          {
-          if (in_buffer->length < MAX_LINE)
-            {
-            buffer_append (line_buffer, in_buffer->c_str[1]);
-            size_and_draw_string (pico7219, line_buffer->c_str);
-            respond_ok();
-            }
-          else
-            respond_error (ERR_TOOLONG, in_buffer->c_str + 1);
-          }
-        else
-          respond_error (ERR_TOOSHORT, NULL);
-        break;
-
-      case CMD_STRING:
-        if (in_buffer->length >= 2)
-          {
-          if (strlen (in_buffer->c_str + 1) < MAX_LINE)
-            {
-            buffer_set (line_buffer, in_buffer->c_str + 1);
-            size_and_draw_string (pico7219, line_buffer->c_str);
-            pico7219_flush (pico7219);
-            respond_ok();
-            }
-          else
-            respond_error (ERR_TOOLONG, in_buffer->c_str + 1);
-          }
-        else
-          respond_error (ERR_TOOSHORT, NULL);
-        break;
-
-      case CMD_RESET:
-        buffer_reset (line_buffer);
-        pico7219_switch_off_all (pico7219, TRUE);
-        pico7219_set_intensity (pico7219, 1);
-        pico7219_set_virtual_chain_length (pico7219, CHAIN_LEN);
-        scroll_count = SCROLL_TIME;
-        scrolling = FALSE;
-        respond_ok();
-        break;
-
-      case CMD_SCROLL:
-        pico7219_scroll (pico7219, TRUE);
-        respond_ok();
-        break;
-
-      case CMD_SCROLLON:
-        scrolling = TRUE;
-        scroll_count = SCROLL_TIME;
-        respond_ok();
-        break;
-
-      case CMD_SCROLLOFF:
-        scrolling = FALSE;
-        scroll_count = SCROLL_TIME;
-        respond_ok();
-        break;
-
-      case CMD_BRIGHTNESS:
-        if (sscanf (in_buffer->c_str + 1, "%d", &x) == 1)
-          {
-          if (x < 0) x = 0;
-          if (x > 15) x = 15;
-          pico7219_set_intensity (pico7219, x);
-          respond_ok();
-          }
-        else 
-          {
-          respond_error (ERR_ARGS, in_buffer->c_str + 1);
-          }
-        break;
-
-      default:
-        respond_error (ERR_BADCMD, in_buffer->c_str + 1);
+      error = parse_args (entry, line + 1, &args);
+      if (error == ERR_NONE)
+        error = entry->handler (cmd, &args);
       }
+    if (error == ERR_NONE)
+      respond_ok();
+    else if (error != ERR_RESPONDED)
+      respond_error (error, error == ERR_TOOSHORT ? NULL : line + 1);
     }
   else
     {
@@ -278,6 +709,285 @@ void process_input_buffer (Pico7219 *pico7219, Buffer *in_buffer,
     respond_error (ERR_TOOSHORT, NULL);
     }
   buffer_reset (in_buffer);
+  sequenced = FALSE;
+  }
+
+//
+// bench_command
+//
+// Time the complete handling of one command line, from parsing to 
+// rendering, with the responses suppressed. 
+//
+void bench_command (const char *prefix, const char *params, 
+       const char *command)
+  {
+  Buffer *line = buffer_new (MAX_INPUT);
+  if (!line) return;
+  quiet = TRUE;
+  int n = 0;
+  uint64_t start = time_us_64(), elapsed;
+  do
+    {
+    // process_input_buffer() empties the buffer
+    buffer_set (line, command);
+    process_input_buffer (line);
+    n++;
+    } while ((elapsed = time_us_64() - start) < BENCH_MIN_US);
+  quiet = FALSE;
+  char name[2] = { command[0], 0 };
+  bench_report (prefix, name, params, elapsed, 0, n);
+  buffer_destroy (line);
+  }
+
+//
+// bench_commands
+//
+// Time the handling of a few typical commands. This leaves the display
+// reset, and the pipelining state as it was.
+//
+void bench_commands (const char *prefix)
+  {
+  static const int lengths[] = { 8, 32, MAX_LINE - 1 };
+  BOOL old_sequenced = sequenced;
+  int old_seq = seq;
+  int old_mode = pipeline_mode;
+  pipeline_mode = PIPELINE_OFF;
+  char command [MAX_LINE + 2];
+  char params [20];
+  bench_command (prefix, "x=200", "A0,200");
+  bench_command (prefix, "n=4", "K1,0,0,1,1,2,2,3,3");
+  bench_command (prefix, "w=32", "X1,0,0,8,32");
+  for (unsigned l = 0; l < sizeof (lengths) / sizeof (lengths[0]); l++)
+    {
+    int len = lengths[l];
+    command[0] = CMD_STRING;
+    for (int i = 0; i < len; i++)
+      command[i + 1] = 'A' + i % 26;
+    command[len + 1] = 0;
+    snprintf (params, sizeof (params), "len=%d", len);
+    bench_command (prefix, params, command);
+    }
+  bench_command (prefix, "", "R");
+  pipeline_mode = old_mode;
+  sequenced = old_sequenced;
+  seq = old_seq;
+  }
+
+//
+// read_frame_bytes
+//
+// Read len bytes of a binary frame into buf. Returns FALSE if the
+// host stops sending before they have all arrived.
+//
+BOOL read_frame_bytes (uint8_t *buf, int len)
+  {
+  return usbrx_read (buf, len, FRAME_BYTE_TIMEOUT_US) == len;
+  }
+
+//
+// discard_input
+//
+// After a broken frame, throw away input until the host stops sending,
+// so that the rest of the frame is not taken to be text commands.
+//
+void discard_input ()
+  {
+  uint8_t buf[64];
+  while (usbrx_read (buf, sizeof (buf), FRAME_BYTE_TIMEOUT_US) > 0)
+    ;
+  }
+
+//
+// queue_bitmap
+//
+// Queue a BITMAP frame, split into commands of at most RENDER_DATA_MAX 
+// bytes. Returns FALSE if the payload is the wrong length, or reaches
+// beyond the largest virtual display.
+//
+BOOL queue_bitmap (const uint8_t *payload, int len)
+  {
+  if (len < 2 + PICO7219_ROWS || (len - 2) % PICO7219_ROWS != 0) 
+    return FALSE;
+  int module = frame_get16 (payload);
+  int n = (len - 2) / PICO7219_ROWS;
+  if (module + n > PICO7219_MAX_VCHAIN) return FALSE;
+  for (int row = 0; row < PICO7219_ROWS; row++)
+    {
+    const uint8_t *bits = payload + 2 + row * n;
+    for (int i = 0; i < n; i += RENDER_DATA_MAX)
+      {
+      int chunk = n - i;
+      if (chunk > RENDER_DATA_MAX) chunk = RENDER_DATA_MAX;
+      RenderCmd *rc = queue_command (FRAME_BITMAP);
+      rc->x = row;
+      rc->y = module + i;
+      rc->len = chunk;
+      memcpy (rc->data, bits + i, chunk);
+      cmdqueue_publish (&cmd_queue);
+      }
+    }
+  return TRUE;
+  }
+
+//
+// queue_delta
+//
+// Queue a DELTA frame, split into commands that each carry as many 
+// whole codes as will fit in RENDER_DATA_MAX bytes, and the position in
+// the difference at which the first one starts. Returns FALSE if the
+// payload is too short, the codes run beyond the end of the payload or
+// of the difference, or the modules reach beyond the largest virtual 
+// display. In that case, nothing is changed.
+//
+BOOL queue_delta (const uint8_t *payload, int len)
+  {
+  // Check the whole thing before queuing any of it
+  if (!frame_check_delta (payload, len)) return FALSE;
+  int module = frame_get16 (payload);
+  int n = frame_get16 (payload + 2);
+  const uint8_t *codes = payload + 4;
+  len -= 4;
+
+  int pos = 0, count;
+  int i = 0;
+  while (i < len)
+    {
+    RenderCmd *rc = queue_command (FRAME_DELTA);
+    rc->x = module;
+    rc->w = n;
+    rc->y = pos;
+    int start = i;
+    int code_len;
+    while (i < len 
+         && i - start + (code_len = frame_delta_code (codes + i, &count))
+           <= RENDER_DATA_MAX)
+      {
+      i += code_len;
+      pos += count;
+      }
+    rc->len = i - start;
+    memcpy (rc->data, codes + start, rc->len);
+    cmdqueue_publish (&cmd_queue);
+    }
+  return TRUE;
+  }
+
+//
+// queue_rect
+//
+// Returns FALSE if the payload is the wrong length, or the rectangle
+// reaches beyond MAX_COLUMNS.
+//
+BOOL queue_rect (const uint8_t *payload, int len)
+  {
+  if (len != 7) return FALSE;
+  if (frame_get16 (payload) + frame_get16 (payload + 3) > MAX_COLUMNS)
+    return FALSE;
+  RenderCmd *rc = queue_command (FRAME_RECT);
+  rc->x = frame_get16 (payload);
+  rc->y = payload[2];
+  rc->w = frame_get16 (payload + 3);
+  rc->h = payload[5];
+  rc->data[0] = payload[6];
+  cmdqueue_publish (&cmd_queue);
+  return TRUE;
+  }
+
+//
+// queue_pixels
+//
+// Queue a PIXELS frame, split into commands that each carry as many
+// (col,row) entries as will fit. If any column is beyond MAX_COLUMNS, 
+// none of the frame is carried out.
+//
+BOOL queue_pixels (const uint8_t *payload, int len)
+  {
+  if (len < 1 || (len - 1) % 3 != 0) return FALSE;
+  for (int i = 1; i < len; i += 3)
+    if (frame_get16 (payload + i) >= MAX_COLUMNS) return FALSE;
+  int per_cmd = RENDER_DATA_MAX / 3 * 3;
+  for (int i = 1; i < len; i += per_cmd)
+    {
+    int chunk = len - i;
+    if (chunk > per_cmd) chunk = per_cmd;
+    RenderCmd *rc = queue_command (FRAME_PIXELS);
+    rc->x = payload[0];
+    rc->len = chunk;
+    memcpy (rc->data, payload + i, chunk);
+    cmdqueue_publish (&cmd_queue);
+    }
+  return TRUE;
+  }
+
+//
+// process_frame
+//
+// Read and carry out a binary frame, whose sync byte has just been
+// received. See frame.h for the frame layout.
+//
+void process_frame ()
+  {
+  uint8_t header [FRAME_HEADER_LEN - 1]; // Everything after the sync byte
+  if (!read_frame_bytes (header, sizeof (header)))
+    {
+    respond_error (ERR_FRAME, "incomplete");
+    return;
+    }
+  uint8_t type = header[0];
+  uint8_t flags = header[1];
+  int len = frame_get16 (header + 2);
+  if (len > FRAME_MAX_PAYLOAD)
+    {
+    discard_input();
+    respond_error (ERR_FRAME, "too_long");
+    return;
+    }
+  if (!read_frame_bytes (frame_buffer, len + FRAME_CRC_LEN))
+    {
+    respond_error (ERR_FRAME, "incomplete");
+    return;
+    }
+  uint16_t crc = frame_crc16 (0xFFFF, header, sizeof (header));
+  crc = frame_crc16 (crc, frame_buffer, len);
+  if (crc != frame_get16 (frame_buffer + len))
+    {
+    respond_error (ERR_CRC, NULL);
+    return;
+    }
+
+  // In pipelined mode, a frame can carry a sequence number before the
+  //  payload proper
+  const uint8_t *payload = frame_buffer;
+  if ((flags & FRAME_FLAG_SEQ) && pipeline_mode != PIPELINE_OFF && len >= 2)
+    {
+    sequenced = pipeline_mode != PIPELINE_EARLY;
+    seq = frame_get16 (payload);
+    payload += 2;
+    len -= 2;
+    }
+
+  BOOL ok = FALSE;
+  switch (type)
+    {
+    case FRAME_BITMAP: ok = queue_bitmap (payload, len); break;
+    case FRAME_RECT: ok = queue_rect (payload, len); break;
+    case FRAME_PIXELS: ok = queue_pixels (payload, len); break;
+    case FRAME_DELTA: ok = queue_delta (payload, len); break;
+    }
+  if (ok)
+    {
+    if (flags & FRAME_FLAG_FLUSH)
+      {
+      queue_command (CMD_FLUSH);
+      submit_command();
+      }
+    else
+      complete_command();
+    respond_ok();
+    }
+  else
+    respond_error (ERR_FRAME, NULL);
+  sequenced = FALSE;
   }
 
 //
@@ -287,61 +997,88 @@ int main()
   {
   stdio_init_all();
 
-  // Create the Pico7219 object, specifying the connected pins and
-  //  baud rate. The last parameter indicates whether the column order
-  //  should be reversed -- this depends on how the LED matrix is wired
-  //  to the MAX7219, and isn't easy to determine except by trying.
-  // With short wiring, the baud rate could be at least twice what is
-  //  set here, but this probably isn't the limiting factor in 
-  //  throughput.
-  Pico7219 *pico7219 = pico7219_create (SPI_CHAN, 2000 * 1000,
-    MOSI, SCK, CS, CHAIN_LEN, FALSE);
-
-  // The module should power on blank, but let's be sure.
-  pico7219_switch_off_all (pico7219, FALSE);
+  // Start the renderer, which owns the display. On the Pico, it runs
+  //  on the other core.
+  cmdqueue_init (&cmd_queue);
+  render_start (&cmd_queue);
 
   // The input buffer, for commands from the host
   Buffer *in_buffer = buffer_new (MAX_INPUT);
 
-  // The line buffer, for text to be displayed
-  Buffer *line_buffer = buffer_new (MAX_LINE);
+  // Number of bytes of the current command that didn't fit in in_buffer
+  int dropped = 0;
+
+  // Time at which data was last received
+  uint64_t last_input_time = 0;
+
+  usbrx_init();
 
-  int c;
   do
      {
-     // Use getchar_timeout_us() so we can scroll the display -- if
-     //  necessary -- while waiting for data from the host
-     while ((c = getchar_timeout_us (1000)) == PICO_ERROR_TIMEOUT)
+     const uint8_t *span;
+     int n = usbrx_peek (&span);
+     if (n == 0)
        {
-       // Handle scrolling
-       if (scrolling)
-         {
-         scroll_count--;
-         if (scroll_count <= 0)
-           {
-           scroll_count = SCROLL_TIME;
-           pico7219_scroll (pico7219, TRUE);
-           }
-         }
+       // The host has stopped sending, so acknowledge whatever 
+       //  sequenced commands it has sent
+       if (pipeline_mode == PIPELINE_ACK && unacked > 0
+           && time_us_64() - last_input_time > IDLE_TIME_US)
+         send_ack();
+       // On the Pico, this core has nothing else to do, so it sleeps 
+       //  until input arrives, or it's time to check for idleness 
+       //  again. In a host build, we have to keep the renderer going.
+#if !PICO_ON_DEVICE
+       render_task();
+#endif
+       usbrx_wait (INPUT_WAIT_US);
+       continue;
        }
-     switch (c)
-       {
-       case 13: break; // Ignore CR (for testing with terminal emulator)
+     last_input_time = time_us_64();
 
-       case 10: // Line feed -- command is complete
-         process_input_buffer (pico7219, in_buffer, line_buffer);  
-         break;
+     // A binary frame, if it's at the start of a message
+     if (in_buffer->pos == 0 && dropped == 0 && span[0] == FRAME_SYNC)
+       {
+       usbrx_consume (1);
+       process_frame ();
+       continue;
+       }
 
-       default:
-         // Note that input that won't fit in the buffer is dropped.
-         buffer_append (in_buffer, c);
+     // Take everything up to the end of the line, or of the span, into 
+     //  the input buffer. Input that won't fit is dropped, but counted.
+     const uint8_t *eol = memchr (span, 10, n);
+     int len = eol ? eol - span : n;
+     dropped += buffer_append_span (in_buffer, (const char *)span, len);
+     usbrx_consume (eol ? len + 1 : len);
+     if (eol)
+       {
+       // Line feed -- command is complete
+       if (dropped)
+         {
+         char text[32];
+         usbrx_count_overflow (dropped);
+         snprintf (text, sizeof (text), "%d bytes dropped", dropped);
+         parse_seq (in_buffer->c_str);
+         respond_error (ERR_TOOLONG, text);
+         buffer_reset (in_buffer);
+         sequenced = FALSE;
+         dropped = 0;
+         }
+       else
+         {
+#if PICO7219_STATS
+         uint32_t start = time_us_32();
+#endif
+         process_input_buffer (in_buffer);  
+#if PICO7219_STATS
+         pico7219_timer_add (&parser_stats.command_time, 
+           time_us_32() - start);
+#endif
+         }
        }
      } while (TRUE);
 
   // For completeness, but we never get here...
 
   buffer_destroy (in_buffer);
-  buffer_destroy (line_buffer);
-  pico7219_destroy (pico7219, FALSE);
   }
 
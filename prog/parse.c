@@ -0,0 +1,125 @@
+/*=========================================================================
+ 
+  Pico7219usb
+
+  parse.c
+
+  Parsing of the arguments of text commands. See parse.h for details.
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+
+#include "prog/parse.h"
+
+//
+// parse_skip_blanks
+//
+const char *parse_skip_blanks (const char *s)
+  {
+  while (*s == ' ' || *s == '\t' || *s == '\r') s++;
+  return s;
+  }
+
+//
+// parse_at_end
+//
+BOOL parse_at_end (const char *s)
+  {
+  return *parse_skip_blanks (s) == 0;
+  }
+
+//
+// parse_int
+//
+BOOL parse_int (const char **s, int *value)
+  {
+  const char *p = parse_skip_blanks (*s);
+  BOOL neg = (*p == '-');
+  if (neg) p++;
+  const char *digits = p;
+  int v = 0;
+  while (*p >= '0' && *p <= '9')
+    {
+    if (p - digits == MAX_DIGITS) return FALSE;
+    v = v * 10 + (*p++ - '0');
+    }
+  if (p == digits) return FALSE;
+  *value = neg ? -v : v;
+  *s = p;
+  return TRUE;
+  }
+
+//
+// parse_ints
+//
+int parse_ints (const char *s, int *values, int max)
+  {
+  if (parse_at_end (s)) return 0;
+  int n = 0;
+  for (;;)
+    {
+    if (n == max || !parse_int (&s, &values[n])) return -1;
+    n++;
+    if (*s != ',') break;
+    s++;
+    }
+  return parse_at_end (s) ? n : -1;
+  }
+
+//
+// parse_hex
+//
+int parse_hex (const char *s, uint8_t *buf, int max)
+  {
+  int n = 0;
+  while (!parse_at_end (s))
+    {
+    int v = 0;
+    for (int i = 0; i < 2; i++, s++)
+      {
+      char c = *s;
+      if (c >= '0' && c <= '9') v = v * 16 + c - '0';
+      else if (c >= 'a' && c <= 'f') v = v * 16 + c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') v = v * 16 + c - 'A' + 10;
+      else return -1;
+      }
+    if (n == max) return -1;
+    buf[n++] = v;
+    }
+  return n;
+  }
+
+//
+// parse_base64
+//
+int parse_base64 (const char *s, uint8_t *buf, int max)
+  {
+  int n = 0, bits = 0;
+  uint32_t acc = 0;
+  for (; !parse_at_end (s) && *s != '='; s++)
+    {
+    char c = *s;
+    int v;
+    if (c >= 'A' && c <= 'Z') v = c - 'A';
+    else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+    else if (c >= '0' && c <= '9') v = c - '0' + 52;
+    else if (c == '+') v = 62;
+    else if (c == '/') v = 63;
+    else return -1;
+    acc = (acc << 6) | v;
+    bits += 6;
+    if (bits >= 8)
+      {
+      bits -= 8;
+      if (n == max) return -1;
+      buf[n++] = (acc >> bits) & 0xFF;
+      }
+    }
+  // Only padding can follow, and a single leftover character can't 
+  //  be a whole byte
+  while (*s == '=') s++;
+  if (!parse_at_end (s) || bits >= 6) return -1;
+  return n;
+  }
+
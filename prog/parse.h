@@ -0,0 +1,75 @@
+/*=========================================================================
+ 
+  Pico7219usb
+
+  parse.h 
+
+  Parsing of the arguments of text commands: decimal integers, and the
+  hex and base64 column data of the COLUMNS command. Blanks -- spaces,
+  tabs, and carriage returns -- are allowed before any integer, and at
+  the end of the line. These functions work on a zero-terminated line,
+  and know nothing about the command table, which is in main.c.
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include <pico7219/pico7219.h>
+
+// The most digits in an integer. That's enough for any argument, and
+//   few enough that the value can't overflow.
+#define MAX_DIGITS 9
+
+//
+// parse_skip_blanks
+//
+// Return a pointer to the first character of s that isn't a blank.
+//
+const char *parse_skip_blanks (const char *s);
+
+//
+// parse_at_end
+//
+// Returns TRUE if there's nothing but blanks left in the string.
+//
+BOOL parse_at_end (const char *s);
+
+//
+// parse_int
+//
+// Parse a decimal integer, with an optional minus sign, at *s, and 
+// move *s past it. Blanks before it are skipped. Returns FALSE if there
+// isn't one, or it has more than MAX_DIGITS digits.
+//
+BOOL parse_int (const char **s, int *value);
+
+//
+// parse_ints
+//
+// Parse a list of comma-separated integers into values. Returns the
+// number of integers, or -1 if there are more than max, or the string
+// holds anything else, apart from blanks before each integer and at 
+// the end.
+//
+int parse_ints (const char *s, int *values, int max);
+
+//
+// parse_hex
+//
+// Decode a string of hexadecimal digits, two for each byte, into buf.
+// Blanks at the end are ignored. Returns the number of bytes, or -1 if
+// the string isn't valid hex, or would decode to more than max bytes.
+//
+int parse_hex (const char *s, uint8_t *buf, int max);
+
+//
+// parse_base64
+//
+// Decode a base64 string into buf. The padding at the end is optional,
+// and blanks after it are ignored. Returns the number of bytes, or -1 if
+// the string isn't valid base64, or would decode to more than max bytes.
+//
+int parse_base64 (const char *s, uint8_t *buf, int max);
+
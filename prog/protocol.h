@@ -23,6 +23,9 @@ The response consists of a numeric code, then a single text token which is
 string version of the numeric code, then perhaps some additional data,
 depending on the error. A success code is "0 OK <LF>"
 
+A binary framed protocol is also available, for sending pixel data in bulk.
+See "Binary frames" below.
+
 Commands fall into three groups:
 
 1. Commands to control the display in general
@@ -32,7 +35,7 @@ Commands fall into three groups:
 In group (1) are commands to reset the display ('R'), control the brightness
 ('I'), and control scrolling behaviour ('S', 'G', and 'H').  Group (2) conists
 only of commands 'A' and 'B' to turn individual LEDs on and off.  Group (3)
-consists of character output ('C') and string output ('D') commands.
+consists of character output ('C') and string output ('D' and 'U') commands.
 
 Note that most commands do not affect the physical display immediately,
 but only when the flush ('F') command is sent. This is to allow more
@@ -55,20 +58,59 @@ Copyright (c)2021 Kevin Boone, GPL v3.0
 // ON -- Arow,col
 // Turn on an LED
 // Row, col are zero-indexed, from the _bottom left_ corner.  It isn't an error
-// to set values that are outside the range of the display, but they are
-// silently ignored.  Values that are outside the range of the physical
-// display, but in the range of the virtual display, could later be scrolled
-// into view, but there is presently no way to extend the size of the virtual
-// display using a command -- this is done automatically when displaying text.
-// I guess it would be possible to display a line of spaces to extend the
-// virtual display. The change is not written to th display hardware until the
-// flush command is issued.
+// to set a row that is outside the range of the display, but it is
+// silently ignored. The column can be anything up to MAX_COLUMNS; the
+// virtual display is extended to include it, so columns outside the range
+// of the physical display can later be scrolled into view. A column
+// beyond MAX_COLUMNS is an ERR_ARGS. The change is not written to the 
+// display hardware until the flush command is issued.
 #define CMD_ON       'A'
 
 // OFF -- Brow,col
 // Turn off an LED. Same considerations as ON apply.
 #define CMD_OFF      'B'
 
+// PIXELS -- Ks,row,col,row,col,...
+// Turn on (if s is 1) or off (if s is 0) any number of LEDs, given as
+// row,col pairs, all separated by commas, with one response. The same
+// considerations as ON apply. If any column is out of range, none of
+// the LEDs is changed.
+#define CMD_PIXELS   'K'
+
+// HLINE -- Ls,row,col,len
+// Turn on (s=1) or off (s=0) a horizontal run of len LEDs, from col 
+// rightwards. The run must end before MAX_COLUMNS. 
+#define CMD_HLINE    'L'
+
+// VLINE -- Js,row,col,len
+// Turn on or off a vertical run of len LEDs, from row upwards. Rows
+// outside the display are ignored.
+#define CMD_VLINE    'J'
+
+// RECT -- Xs,row,col,height,width
+// Turn on or off a filled rectangle, whose bottom-left corner is at
+// row,col. So, for example, the "1" of a 3x5 clock digit whose bottom 
+// left corner is at the bottom left of the display is X1,0,2,5,1. As
+// with VLINE, rows outside the display are ignored. Like the ON and OFF
+// commands, all these change the display only when it is flushed.
+#define CMD_RECT     'X'
+
+// COLUMNS -- Ecol,hex
+// Set whole columns of LEDs, starting at column col, from a run of 
+// hexadecimal digits, two for each column. In each column byte, bit r is 
+// row r, so the LSB is the bottom row: "E0,01ff80" lights the bottom LED
+// of column 0, all of column 1, and the top LED of column 2. The LEDs 
+// are replaced, not added to. The last column must be before MAX_COLUMNS.
+// Like the ON and OFF commands, this changes the display only when it is 
+// flushed. So a host can render a 32-column frame itself, with any font 
+// or image tool, and send it in one line of about 70 characters. 
+#define CMD_COLUMNS  'E'
+
+// COLUMNS64 -- Ocol,base64
+// The same as COLUMNS, but the column bytes are base64-encoded, so a 
+// 32-column frame takes 44 characters. Padding ('=') is optional.
+#define CMD_COLUMNS64 'O'
+
 // CHAR -- Cc 
 // Adds a character to the display buffer. The display is not updated
 //  until the flush command is issued. In practice, it will usually
@@ -77,7 +119,9 @@ Copyright (c)2021 Kevin Boone, GPL v3.0
 #define CMD_CHAR     'C'
 
 // STRING -- Dstring
-// Replaces the line buffer with 'string'. Changes are effected immediately.
+// Replaces the line buffer with 'string', and replaces whatever was on the
+// display (including individual LEDs) with the new text. Changes are
+// effected immediately, and the text is shown from the start.
 // There is a limit on the string length and, of course, a string longer than a
 // few characters will not fit on the display anyway. However, a longer string
 // can be sent, and then scrolled into view, either by enabling automatic
@@ -86,26 +130,79 @@ Copyright (c)2021 Kevin Boone, GPL v3.0
 // config.h, but be careful of memory usage. If the display is currently
 // scrolling, this command will not change that -- the new text will also
 // scroll. This command will not force scrolling to start, even if the text
-// doesn't fit on the display. 
+// doesn't fit on the display. The new text is drawn off-screen, and 
+// replaces the old text between two scroll steps, so it's safe to send it
+// while the display is scrolling.
 #define CMD_STRING   'D'
 
+// ROLL -- Nstring
+// The same as STRING, except that the new text rolls in from below,
+// pushing the old text up and off the top of the display, one row 
+// every ROLL_TIME_US (see config.h). This is a cheap way to switch
+// between status lines, as each step only rotates rows.
+#define CMD_ROLL     'N'
+
+// UPDATE -- Ustring
+// The same as STRING, except that the display stays at the same scroll
+// position, rather than going back to the start of the text. This is 
+// for text that changes while it is scrolling, like a news ticker -- the
+// new text just carries on scrolling from where the old text was.
+#define CMD_UPDATE   'U'
+
 // FLUSH -- F
-// Flush changes to the physical hardware.
+// Flush changes to the physical hardware. Changes made by the ON, OFF and 
+// CHAR commands are made off-screen, and all appear together when this
+// command is sent, without disturbing scrolling.
 #define CMD_FLUSH    'F'
 
 // SCROLL_ON -- G
 // Enable scrolling. The physical display can be viewed as a window onto
 // a larger "virtual" display. Scrolling moves this window to the right,
-// so text appears to move to the left. The scrolling speed is about
-// ten pixels per second -- it's difficult to get it much faster than
-// this because of the amount of bit-bashing needed.
+// so text appears to move to the left. The scrolling speed is set by the
+// SPEED command. Text that fits on the display doesn't scroll (except
+// vertically), and nothing is sent to the display until it no longer 
+// fits, so scrolling can be left on all the time. Text that doesn't fit
+// is followed by a gap of at least SCROLL_GAP columns (see config.h) 
+// before it comes round again.
 #define CMD_SCROLLON 'G'
 
+// SCROLL_MODE -- Mn
+// Set the direction in which the SCROLL and SCROLL_ON commands move the
+// display, as one of the SCROLL_MODE_xxx values below. The default is 
+// SCROLL_MODE_LEFT. In the vertical modes, the rows of the display 
+// rotate, so a row that scrolls off one edge comes back at the other; 
+// the SPEED command then sets the speed in rows per second. 
+// SCROLL_MODE_RIGHT moves text the other way from SCROLL_MODE_LEFT. 
+// SCROLL_MODE_BOUNCE moves the text left until its end is at the right
+// edge of the display, then back again until its start is at the left
+// edge, pausing for BOUNCE_PAUSE_US (see config.h) at each end, so text
+// a little too long for the display can be read without waiting for the
+// whole virtual display to go past. Text that fits doesn't move. The 
+// text's length is taken to be the length of the text line, or the 
+// right-most column that the ON, OFF or binary frame commands have
+// reached, whichever is more.
+#define CMD_SCROLLMODE 'M'
+
+#define SCROLL_MODE_LEFT   0
+#define SCROLL_MODE_UP     1
+#define SCROLL_MODE_DOWN   2
+#define SCROLL_MODE_RIGHT  3
+#define SCROLL_MODE_BOUNCE 4
+#define SCROLL_MODE_MAX    SCROLL_MODE_BOUNCE
+
 // SCROLL_OFF -- H
 // Disable scrolling. Note that the scrolling position stays where it is, which
 // might not leave the beginning of the current text in the display.
 #define CMD_SCROLLOFF 'H'
 
+// SPEED -- Vn
+// Set the automatic scrolling speed to n pixels per second, from 1 to 
+// SCROLL_MAX_SPEED (see config.h). The default is SCROLL_SPEED. If the 
+// display can't be updated that often, each frame moves the display by
+// more than one pixel, so the text still moves at the same speed. 
+// This takes effect immediately, even if the display is scrolling.
+#define CMD_SPEED    'V'
+
 // BRIGHTNESS -- In
 // 'n' is 0-15
 // Note that there is no "off" brightness -- even zero-brightness is visible.
@@ -116,15 +213,178 @@ Copyright (c)2021 Kevin Boone, GPL v3.0
 // supply. 
 #define CMD_BRIGHTNESS 'I'
 
+// BENCH -- T
+// Run the benchmarks (see bench.h), and send the results before the usual
+// response, one line each, starting with "# ". The display benchmarks don't
+// touch the display, but the command benchmarks do, and leave it reset.
+// This takes a few seconds, during which no other command is handled.
+#define CMD_BENCH    'T'
+
+// PIPELINE -- Pn
+// Set the pipelining mode, described below. n is one of the PIPELINE_xxx
+// values. This command is always answered, in the form that applied when
+// it was sent, once every command before it has been carried out. If it
+// has no sequence number, any sequenced commands that have not yet been
+// acknowledged are acknowledged first.
+#define CMD_PIPELINE 'P'
+
+// STATS -- Qn
+// Report counts and timings, as "0 OK" followed by a list of name=value
+// items, all on one line. Timings are in microseconds, in the form 
+// min/average/max. If n is 1, everything is set back to zero once it has 
+// been reported. The items are:
+//   flushes   -- number of display flushes
+//   rows      -- number of rows written to the display
+//   bytes     -- number of bytes sent to the display
+//   flush_us  -- time from the start of a flush until it has been sent 
+//   scroll_us -- time from the start of a scroll step until it has been sent
+//   jitter_us -- how late automatic scroll steps start
+//   cmds      -- number of command lines handled
+//   cmd_us    -- time to handle a command line (from parsing to 
+//                rendering, unless pipelined or answered early)
+//   errors    -- number of error responses
+//   too_long  -- number of ERR_TOOLONG responses
+//   dropped   -- number of input bytes dropped, because a line was too
+//                long or the receive buffer was full
+// This is only available if the firmware is built with PICO7219_STATS set;
+// otherwise it's an ERR_BADCMD.
+#define CMD_STATS    'Q'
+
 // RESET -- R
-// Clear pixels, clear the line buffer, stop scrolling, set brightness to 1
+// Clear pixels, clear the line buffer, stop scrolling, set brightness to 1,
+// and set the scroll speed and mode back to the defaults.
+// Every module is rewritten, even if the firmware thinks it is already
+// blank, so this will also clear up a display that has been disturbed.
 #define CMD_RESET    'R'
 
 // SCROLL -- S 
-// Scroll one pixel left. If scrolling is already active, this won't be
-// visible. Implicitly flushes updates to the hardware.
+// Scroll one pixel left (or one row, in a vertical scroll mode). If 
+// scrolling is already active, this won't be visible. Implicitly flushes
+// updates to the hardware.
 #define CMD_SCROLL   'S'
 
+// SYNC -- W
+// Respond once every command before this one has been carried out, and
+// the display has been sent everything, including the whole of any roll
+// in progress. In PIPELINE_EARLY mode, this is how the host finds out 
+// that the display has caught up. In a pipelined mode, a sequenced SYNC
+// is always acknowledged, in the same way as PIPELINE.
+#define CMD_SYNC     'W'
+
+//
+// Pipelining
+//
+// Normally, every command gets a response once it has been carried out, 
+// and the host must wait for it before sending the next command. In
+// pipelined mode, a host can keep many commands in flight. A command line
+// that starts with a decimal sequence number (0-65535, optionally followed
+// by one space) is not answered individually. If it fails, the error is
+// reported as usual, but with '@' and the sequence number in front:
+//
+// @123 2 bad_arguments xyz
+//
+// Successful commands are acknowledged cumulatively:
+//
+// @130 0 OK
+//
+// means that all sequenced commands up to and including number 130 have
+// been carried out. Any errors among them will already have been reported,
+// and a command that got an error is not acknowledged again: its error is
+// its only answer. If the last commands before an acknowledgement is due
+// all failed, the acknowledgement gives the last one that succeeded, and 
+// if none did, there is no acknowledgement.
+// In PIPELINE_ACK mode, this acknowledgement is sent after every
+// PIPELINE_WINDOW commands, and whenever the host stops sending. In 
+// PIPELINE_ERRORS mode, only errors are reported; to find out when
+// everything has been done, the host can send a PIPELINE command, which 
+// is always acknowledged. Commands without a sequence number are answered
+// one at a time, as usual, in either mode. Binary frames can carry a 
+// sequence number too -- see FRAME_FLAG_SEQ. A line that starts with a
+// number larger than 65535 gets an ERR_ARGS response, without a 
+// sequence number, and is not carried out.
+//
+// PIPELINE_EARLY mode is simpler: there are no sequence numbers, and every
+// command is answered as usual, but as soon as it has been checked and
+// queued, rather than when it has been carried out. So the host needn't
+// wait for text to be drawn and sent to the display before sending the
+// next command. The renderer's queue holds only a few commands (see
+// CMDQUEUE_LEN in cmdqueue.h); once it is full, each response waits until
+// there is room for the command. A SYNC command finds out when 
+// everything has been done.
+#define PIPELINE_OFF    0
+#define PIPELINE_ACK    1
+#define PIPELINE_ERRORS 2
+#define PIPELINE_EARLY  3
+
+// Number of sequenced commands after which a cumulative acknowledgement
+//   is sent, even if the host is still sending. A host should not have
+//   more than this many unacknowledged commands in flight.
+#define PIPELINE_WINDOW 16
+
+// Sequence numbers wrap at this mask
+#define PIPELINE_SEQ_MASK 0xFFFF
+
+//
+// Binary frames
+//
+// As well as the text commands above, the firmware accepts binary frames,
+// which can carry a lot of pixel data in one message. The layout of a 
+// frame is described in frame.h. Every frame gets a normal text response. 
+// If the FRAME_FLAG_FLUSH flag is set, the changes are flushed to the 
+// display once the frame has been processed, exactly as if the FLUSH command
+// had been sent. So, for example, a whole 32x8 display can be replaced 
+// using one BITMAP frame, with one response. Column and row numbers are the
+// same as in the ON and OFF commands.
+
+// BITMAP
+// Payload: module (2 bytes), then 8 rows of n bytes
+// Replace the LED states of n whole modules of the virtual chain, starting
+// at the given module number. So the first byte of each row covers 
+// columns 8*module to 8*module+7, and the LSB of each byte is its left-most
+// column. Rows are sent in order from row 0. The payload length, less two,
+// must be a multiple of 8.
+#define FRAME_BITMAP 0x01
+
+// RECT 
+// Payload: col (2 bytes), row (1 byte), width (2 bytes), height (1 byte),
+// state (1 byte)
+// Turn on (state = 1) or off (state = 0) all the LEDs in a rectangle.
+#define FRAME_RECT   0x02
+
+// PIXELS 
+// Payload: state (1 byte), then n * [col (2 bytes), row (1 byte)]
+// Turn on (state = 1) or off (state = 0) a list of LEDs.
+#define FRAME_PIXELS 0x03
+
+// DELTA
+// Payload: module (2 bytes), n (2 bytes), then codes
+// Change n whole modules of the virtual chain, starting at the given 
+// module, by exclusive-ORing them with a run-length coded difference. 
+// The difference has the same layout as the BITMAP payload -- 8 rows of
+// n bytes -- but is sent as a series of codes, each of which covers the
+// next few bytes of it:
+//   0x00-0x7F  skip c+1 bytes, which don't change (1-128)
+//   0x80-0xBF  one data byte follows, which changes the next c-0x7F 
+//              bytes (1-64)
+//   0xC0-0xFF  c-0xBF data bytes follow, which change the same number
+//              of bytes (1-64)
+// Each data byte is exclusive-ORed with a byte of the virtual chain, so
+// a 1 bit toggles an LED. If the codes cover less than the whole 
+// difference, the rest doesn't change. For animation, where each frame
+// differs from the last in a few bytes, this is far shorter than a 
+// BITMAP, and only the rows that change are written to the display.
+#define FRAME_DELTA  0x04
+
+// Flags
+#define FRAME_FLAG_FLUSH 0x01
+
+// In pipelined mode, the first two bytes of the payload are a sequence 
+//  number, and the frame is answered in the same way as a sequenced text
+//  command. The rest of the payload is as described above. In 
+//  PIPELINE_EARLY mode, the number is skipped, and the frame is answered
+//  like any other command.
+#define FRAME_FLAG_SEQ   0x02
+
 // 
 // Error codes
 //
@@ -139,9 +399,18 @@ Copyright (c)2021 Kevin Boone, GPL v3.0
 // Unknown command character
 #define ERR_BADCMD   3
 
-// Command input too long (e.g., too many characters in string)
+// Command input too long (e.g., too many characters in string). A command
+// line that is too long even to be read in full is also rejected with
+// this error, and the response says how many bytes were dropped.
 #define ERR_TOOLONG  4
 
+// Binary frame has the wrong CRC
+#define ERR_CRC      5
+
+// Binary frame is incomplete, too long, of unknown type, or its payload 
+// is the wrong length for its type
+#define ERR_FRAME    6
+
 // Display brightness in the range 0-15
 #define PICO7219_MAX_BRIGHTNESS 15
 #define PICO7219_MIN_BRIGHTNESS 0
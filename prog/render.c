@@ -0,0 +1,766 @@
+/*=========================================================================
+ 
+  Pico7219usb
+
+  render.c
+
+  The display renderer, which owns the Pico7219 instance. It carries
+  out the commands that core 0 puts in the command queue, and
+  handles the scroll timing. See render.h for details.
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#include <pico7219/pico7219.h> 
+#include <pico/stdlib.h>
+#if PICO_ON_DEVICE
+#include <pico/multicore.h>
+#include "hardware/sync.h"
+#define RENDER_WAKE() __sev()
+#else
+#define RENDER_WAKE()
+#endif
+#include <string.h>
+#include "prog/buffer.h" 
+#include "prog/config.h"
+#include "prog/frame.h"
+#include "prog/protocol.h"
+#include "prog/render.h"
+
+extern uint8_t font8_table[];
+
+
+// The display, and the text line that is drawn on it. These belong to
+//   the renderer -- core 0 never touches them.
+static Pico7219 *pico7219 = NULL;
+static Buffer *line_buffer = NULL;
+
+// The queue of commands to carry out
+static CmdQueue *cmd_queue = NULL;
+
+// Set to TRUE if the display should be scrolled automatically
+static BOOL scrolling = FALSE;
+
+// The direction of scrolling, one of the SCROLL_MODE_xxx values
+static int scroll_mode = SCROLL_MODE_LEFT;
+
+// The number of columns of the virtual chain that hold something, for
+//   SCROLL_MODE_BOUNCE. This is the width of the text, or the right-most
+//   column that has been set, whichever is more.
+static int content_width = 0;
+
+// In SCROLL_MODE_BOUNCE, the direction the display window is moving in
+//   (1 is to the right, so the text moves left), and the time until 
+//   which it stays still, at one end of the text
+static int bounce_dir = 1;
+static uint64_t bounce_pause_until = 0;
+
+// Set to TRUE while a roll transition (CMD_ROLL) is in progress, and the
+//   time at which its next step is due. The parser reads rolling too,
+//   to find out when the display has caught up.
+static volatile BOOL rolling = FALSE;
+static uint64_t next_roll_time = 0;
+
+// Time in microseconds between scroll steps, set by CMD_SPEED
+static uint32_t scroll_period = 1000000 / SCROLL_SPEED;
+
+// The timer that schedules automatic scroll steps. Its callback runs in
+//   interrupt context, on whichever core owns the SDK's default alarm 
+//   pool, so all it does is count ticks. The renderer keeps its own 
+//   count of the ticks it has dealt with, and scrolls by the difference,
+//   so neither side ever writes the other's counter.
+static repeating_timer_t scroll_timer;
+static volatile uint32_t scroll_ticks = 0;
+static uint32_t scroll_ticks_done = 0;
+
+// Time (from time_us_64()) at which the scroll timer was started. Tick n
+//   is due at scroll_epoch + n * scroll_period.
+static uint64_t scroll_epoch = 0;
+
+// TRUE while a frame is being sent to the display in the background.
+//   This is cleared by the flush completion callback.
+static volatile BOOL flushing = FALSE;
+
+#if PICO7219_STATS
+// Counts and timings, for CMD_STATS. The snapshot is what core 0 reads.
+static RenderStats stats;
+static RenderStats stats_snapshot;
+// Time at which the scroll step being sent started, and whether the
+//   flush in progress is a scroll step
+static uint32_t scroll_start = 0;
+static volatile BOOL scroll_frame = FALSE;
+#endif
+
+//
+// flush_done
+//
+// Called by the Pico7219 library when an async flush has been sent.
+// On the Pico, this is called in interrupt context, and wakes the
+// renderer, which may be waiting for an event.
+//
+static void flush_done (Pico7219 *pico7219, void *user_data)
+  {
+  (void)pico7219; (void)user_data;
+#if PICO7219_STATS
+  if (scroll_frame)
+    {
+    pico7219_timer_add (&stats.scroll_frame, time_us_32() - scroll_start);
+    scroll_frame = FALSE;
+    }
+#endif
+  flushing = FALSE;
+  RENDER_WAKE();
+  }
+
+//
+// start_flush
+//
+// Start writing the display changes to the hardware, and return 
+// without waiting. 
+//
+static void start_flush (void)
+  {
+  flushing = TRUE;
+  pico7219_flush_async (pico7219, flush_done, NULL);
+  }
+
+//
+// bounce
+//
+// Move the display window n pixels towards the current end of the 
+// content, for SCROLL_MODE_BOUNCE. If it reaches the end, it turns 
+// round, and pauses before setting off again. Returns FALSE if the 
+// window doesn't move.
+//
+static BOOL bounce (int n)
+  {
+  int end = content_width - PICO7219_COLS * CHAIN_LEN;
+  int offset = pico7219_get_scroll_offset (pico7219);
+  if (end <= 0)
+    {
+    // Everything fits -- leave it where it starts
+    bounce_dir = 1;
+    if (offset == 0) return FALSE;
+    pico7219_set_scroll_offset (pico7219, 0);
+    return TRUE;
+    }
+  if (offset > end) offset = end;
+  offset += bounce_dir * n;
+  if (offset >= end || offset <= 0)
+    {
+    offset = offset <= 0 ? 0 : end;
+    bounce_dir = offset == 0 ? 1 : -1;
+    bounce_pause_until = time_us_64() + BOUNCE_PAUSE_US;
+    }
+  pico7219_set_scroll_offset (pico7219, offset);
+  return TRUE;
+  }
+
+//
+// scroll_step
+//
+// Move the display window n pixels along the virtual chain, or n rows
+// up or down, according to the scroll mode, and start sending the new 
+// frame. Returns FALSE if the display doesn't move, and nothing is sent.
+//
+static BOOL scroll_step (int n)
+  {
+  switch (scroll_mode)
+    {
+    case SCROLL_MODE_UP:
+      pico7219_set_vscroll_offset (pico7219, 
+        pico7219_get_vscroll_offset (pico7219) - n);
+      break;
+    case SCROLL_MODE_DOWN:
+      pico7219_set_vscroll_offset (pico7219, 
+        pico7219_get_vscroll_offset (pico7219) + n);
+      break;
+    case SCROLL_MODE_RIGHT:
+      pico7219_set_scroll_offset (pico7219, 
+        pico7219_get_scroll_offset (pico7219) - n);
+      break;
+    case SCROLL_MODE_BOUNCE:
+      if (!bounce (n)) return FALSE;
+      break;
+    default:
+      pico7219_set_scroll_offset (pico7219, 
+        pico7219_get_scroll_offset (pico7219) + n);
+    }
+#if PICO7219_STATS
+  scroll_start = time_us_32();
+  scroll_frame = TRUE;
+#endif
+  start_flush ();
+  return TRUE;
+  }
+
+//
+// scroll_tick
+//
+// The scroll timer's callback. This runs in interrupt context, and
+// wakes the renderer, which may be waiting for an event.
+//
+static bool scroll_tick (repeating_timer_t *timer)
+  {
+  (void)timer;
+  scroll_ticks++;
+  RENDER_WAKE();
+  return true;
+  }
+
+//
+// scroll_stop
+//
+static void scroll_stop (void)
+  {
+  if (scrolling)
+    cancel_repeating_timer (&scroll_timer);
+  scrolling = FALSE;
+  }
+
+//
+// scroll_start_timer
+//
+// Start (or restart) automatic scrolling, with the first step one 
+// period from now. A negative delay makes the SDK time each tick from 
+// the start of the last one, so the period doesn't drift.
+//
+static void scroll_start_timer (void)
+  {
+  scroll_stop ();
+  scroll_ticks = 0;
+  scroll_ticks_done = 0;
+  scroll_epoch = time_us_64();
+  scrolling = add_repeating_timer_us (-(int64_t)scroll_period, 
+    scroll_tick, NULL, &scroll_timer);
+  }
+
+// Draw a character to the display. Note that the width of the "virtual
+// display" can be much longer than the physical module chain, and
+// off-display elements can later be scrolled into view. However, it's
+// the job of the application, not the Pico7219 library, to size the virtual
+// display sufficiently to fit all the text in.
+//
+// chr is an offset in the font table, which corresponds to a character 
+// code, as the font table extends down to character zero. The CP437
+// character set defines printable characters in the 0-31 range, that
+// are not ASCII characters and which may, conceivably, be useful.
+static void draw_character (Pico7219 *display, uint8_t chr, int x_offset, 
+        BOOL flush)
+  {
+  // The font elements are one byte wide even though, as it's an 8x5 font,
+  //   only the top five bits of each byte are used. The font table has 
+  //   the top row first, but row 0 is the bottom row of the display.
+  const uint8_t *glyph = font8_table + 8 * chr;
+  uint8_t rows[PICO7219_ROWS];
+  for (int i = 0; i < PICO7219_ROWS; i++) 
+    rows[7 - i] = glyph[i];
+  pico7219_blit (display, x_offset, rows, TRUE, flush);
+  }
+
+//
+// render_text
+//
+// See render.h
+//
+void render_text (Pico7219 *display, const char *s, int x)
+  {
+  while (*s)
+    {
+    draw_character (display, *s, x, FALSE); 
+    s++;
+    x += 6;
+    }
+  }
+
+// Draw a string of text on the (virtual) display. This function assumes
+// that the library has already been configured to provide a virtual
+// chain of LED modules that is long enough to fit all the text onto.
+static void draw_string (const char *s, BOOL flush)
+  {
+  render_text (pico7219, s, 0);
+  if (flush)
+    pico7219_flush (pico7219);
+  }
+
+// Get the number of horizontal pixels that a string will take. Since each
+// font element is five pixels wide, and there is one pixel between each
+// character, we just multiply the string length by 6.
+static int get_string_length_pixels (const char *s)
+  {
+  return strlen (s) * 6;
+  }
+
+//
+// get_modules_for_width
+//
+// Get the number of 8x8 LED modules needed for the virtual display to
+// hold content of the given width, in pixels. If it fits on the 
+// physical display, that's all that is needed. Otherwise, there must
+// be room for a gap after it, so that when it scrolls round, the end
+// doesn't run into the start.
+//
+static int get_modules_for_width (int width)
+  {
+  if (width <= PICO7219_COLS * CHAIN_LEN) return CHAIN_LEN;
+  return (width + SCROLL_GAP + PICO7219_COLS - 1) / PICO7219_COLS;
+  }
+
+//
+// content_fits
+//
+// Returns TRUE if everything that has been drawn fits on the physical
+// display, so there's no need to scroll it sideways
+//
+static BOOL content_fits (void)
+  {
+  return content_width <= PICO7219_COLS * CHAIN_LEN;
+  }
+
+//
+// size_and_draw_string
+//
+// Set the virtual module length to match the number of characters
+// in the string, allowing for a gap after it, then draw the string.
+// The display must already be blank.
+static void size_and_draw_string (const char *string)
+  {
+  content_width = get_string_length_pixels (string);
+  pico7219_set_virtual_chain_length (pico7219, 
+    get_modules_for_width (content_width));
+  draw_string (string, FALSE);
+  }
+
+//
+// size_for_column
+//
+// Make sure the virtual chain is long enough to include column x
+//
+static void size_for_column (int x)
+  {
+  if (x >= content_width) content_width = x + 1;
+  int slm = x / 8 + 1;
+  if (slm < CHAIN_LEN) slm = CHAIN_LEN;
+  if (slm > pico7219_get_virtual_chain_length (pico7219)) 
+    pico7219_set_virtual_chain_length (pico7219, slm);
+  }
+
+static void size_and_turn_on (int x, int y)
+  {
+  size_for_column (x);
+  pico7219_switch_on (pico7219, y, x, FALSE);
+  }
+
+static void size_and_turn_off (int x, int y)
+  {
+  size_for_column (x);
+  pico7219_switch_off (pico7219, y, x, FALSE);
+  }
+
+//
+// set_pixel
+//
+static void set_pixel (int x, int y, BOOL on)
+  {
+  if (on)
+    pico7219_switch_on (pico7219, y, x, FALSE);
+  else
+    pico7219_switch_off (pico7219, y, x, FALSE);
+  }
+
+//
+// apply_delta
+//
+// Exclusive-OR count bytes into the virtual chain, starting at byte pos
+// of a DELTA frame's difference, which is n modules wide and starts at 
+// the given module. The bytes can run on from one row to the next.
+//
+static void apply_delta (int module, int n, int pos, const uint8_t *bits, 
+       int count)
+  {
+  while (count > 0)
+    {
+    int row = pos / n;
+    int m = pos % n;
+    int k = n - m;
+    if (k > count) k = count;
+    pico7219_xor_vrow_bytes (pico7219, row, module + m, bits, k, FALSE);
+    bits += k;
+    pos += k;
+    count -= k;
+    }
+  }
+
+//
+// execute_delta
+//
+// Carry out part of a DELTA frame. x is the first module, w the number
+// of modules, and y the position in the difference at which the codes
+// start. The parser has already checked that they fit.
+//
+static void execute_delta (const RenderCmd *rc)
+  {
+  size_for_column (8 * (rc->x + rc->w) - 1);
+  int pos = rc->y;
+  for (int i = 0; i < rc->len; )
+    {
+    int count;
+    int code_len = frame_delta_code (rc->data + i, &count);
+    const uint8_t *code = rc->data + i;
+    if (code[0] >= FRAME_DELTA_LITERAL)
+      apply_delta (rc->x, rc->w, pos, code + 1, count);
+    else if (code[0] >= FRAME_DELTA_REPEAT)
+      {
+      uint8_t bits [FRAME_DELTA_LITERAL - FRAME_DELTA_REPEAT];
+      memset (bits, code[1], count);
+      apply_delta (rc->x, rc->w, pos, bits, count);
+      }
+    pos += count;
+    i += code_len;
+    }
+  }
+
+//
+// execute_frame
+//
+// Carry out one part of a binary frame
+//
+static void execute_frame (const RenderCmd *rc)
+  {
+  switch (rc->cmd)
+    {
+    case FRAME_BITMAP:
+      // One row of the bitmap -- x is the row, y the first module
+      size_for_column (8 * (rc->y + rc->len) - 1);
+      pico7219_set_vrow_bytes (pico7219, rc->x, rc->y, rc->data, 
+        rc->len, FALSE);
+      break;
+
+    case FRAME_RECT:
+      // Also used for the HLINE, VLINE and RECT commands
+      if (rc->w <= 0) break;
+      size_for_column (rc->x + rc->w - 1);
+      pico7219_fill_rect (pico7219, rc->y, rc->x, rc->h, rc->w, 
+        rc->data[0], FALSE);
+      break;
+
+    case FRAME_DELTA:
+      execute_delta (rc);
+      break;
+
+    case FRAME_PIXELS:
+      // data is a list of (col, row) pairs, and x the state
+      for (int i = 0; i < rc->len; i += 3)
+        {
+        int x = rc->data[i] | (rc->data[i + 1] << 8);
+        size_for_column (x);
+        set_pixel (x, rc->data[i + 2], rc->x);
+        }
+      break;
+    }
+  }
+
+//
+// execute
+//
+// Carry out one command from the queue. The command has already been
+// checked by the parser, so there is nothing to go wrong here.
+//
+static void execute (const RenderCmd *rc)
+  {
+  switch (rc->cmd)
+    {
+    case CMD_ON:
+      size_and_turn_on (rc->y, rc->x);
+      break;
+
+    case CMD_OFF:
+      size_and_turn_off (rc->y, rc->x);
+      break;
+
+    case CMD_FLUSH:
+      pico7219_commit (pico7219, TRUE);
+      start_flush ();
+      break;
+
+    case CMD_COLUMNS:
+      // x is the first column
+      size_for_column (rc->x + rc->len - 1);
+      pico7219_set_columns (pico7219, rc->x, rc->data, rc->len, FALSE);
+      break;
+
+    case CMD_CHAR:
+      // Everything already on the display stays where it is, so we only
+      //  need to draw the new character, after making room for it
+      {
+      int pos = line_buffer->pos;
+      int x = pos * 6;
+      int slm = get_modules_for_width (x + 6);
+      buffer_append (line_buffer, rc->text[0]);
+      if (line_buffer->pos > pos 
+           && pico7219_grow_virtual_chain (pico7219, slm))
+        {
+        draw_character (pico7219, rc->text[0], x, FALSE);
+        if (content_width < x + 6) content_width = x + 6;
+        }
+      }
+      break;
+
+    case CMD_STRING:
+    case CMD_UPDATE:
+      // Draw the new text in the back buffer, so the display carries
+      //  on scrolling the old text until the new text is complete
+      buffer_set (line_buffer, rc->text);
+      pico7219_switch_off_all (pico7219, FALSE);
+      size_and_draw_string (line_buffer->c_str);
+      pico7219_commit (pico7219, rc->cmd == CMD_UPDATE);
+      start_flush ();
+      break;
+
+    case CMD_ROLL:
+      // Remember what's displayed now, and roll the new text in under
+      //  it, a row at a time -- see render_task()
+      pico7219_begin_roll (pico7219);
+      buffer_set (line_buffer, rc->text);
+      pico7219_switch_off_all (pico7219, FALSE);
+      size_and_draw_string (line_buffer->c_str);
+      pico7219_commit (pico7219, FALSE);
+      rolling = TRUE;
+      next_roll_time = time_us_64() + ROLL_TIME_US;
+      break;
+
+    case CMD_RESET:
+      // Finish any roll at once
+      while (pico7219_roll_step (pico7219));
+      rolling = FALSE;
+      buffer_reset (line_buffer);
+      content_width = 0;
+      pico7219_invalidate (pico7219);
+      pico7219_reset_virtual_chain (pico7219, CHAIN_LEN);
+      pico7219_commit (pico7219, FALSE);
+      pico7219_flush (pico7219);
+      pico7219_set_intensity (pico7219, 1);
+      scroll_stop ();
+      scroll_period = 1000000 / SCROLL_SPEED;
+      scroll_mode = SCROLL_MODE_LEFT;
+      break;
+
+    case CMD_SCROLL:
+      // Like a flush, this shows any changes that are waiting
+      pico7219_commit (pico7219, TRUE);
+      if (!scroll_step (1))
+        start_flush ();
+      break;
+
+    case CMD_SCROLLON:
+      scroll_start_timer ();
+      break;
+
+    case CMD_SCROLLOFF:
+      scroll_stop ();
+      break;
+
+    case CMD_SCROLLMODE:
+      scroll_mode = rc->x;
+      bounce_dir = 1;
+      bounce_pause_until = 0;
+      break;
+
+    case CMD_SPEED:
+      scroll_period = 1000000 / rc->x;
+      if (scrolling)
+        scroll_start_timer ();
+      break;
+
+#if PICO7219_STATS
+    case CMD_STATS:
+      pico7219_get_stats (pico7219, &stats.display);
+      stats_snapshot = stats;
+      if (rc->x)
+        {
+        pico7219_reset_stats (pico7219);
+        memset (&stats, 0, sizeof (stats));
+        }
+      break;
+#endif
+
+    case CMD_BRIGHTNESS:
+      pico7219_set_intensity (pico7219, rc->x);
+      break;
+
+    default:
+      execute_frame (rc);
+    }
+  }
+
+//
+// render_task
+//
+void render_task (void)
+  {
+  const RenderCmd *rc;
+  while ((rc = cmdqueue_peek (cmd_queue)))
+    {
+    execute (rc);
+    cmdqueue_release (cmd_queue);
+    }
+
+  // Handle scrolling. If the last frame is still being sent, leave
+  //  the next scroll step until it has finished. By then, more than one
+  //  tick might have arrived, and the step moves one pixel for each, so
+  //  the text moves at the same speed however fast the display is. 
+  if (scrolling && !flushing)
+    {
+    uint32_t ticks = scroll_ticks;
+    int n = ticks - scroll_ticks_done;
+    // Bouncing text stays still for a while at each end 
+    if (n > 0 && scroll_mode == SCROLL_MODE_BOUNCE 
+         && time_us_64() < bounce_pause_until)
+      {
+      scroll_ticks_done = ticks;
+      n = 0;
+      }
+    // Content that fits on the display only needs to go back to the 
+    //  start, if it isn't there already
+    if (n > 0 && (scroll_mode == SCROLL_MODE_LEFT 
+         || scroll_mode == SCROLL_MODE_RIGHT) && content_fits())
+      {
+      scroll_ticks_done = ticks;
+      n = 0;
+      if (pico7219_get_scroll_offset (pico7219) != 0)
+        {
+        pico7219_set_scroll_offset (pico7219, 0);
+        start_flush ();
+        }
+      }
+    if (n > 0)
+      {
+#if PICO7219_STATS
+      uint64_t due = scroll_epoch 
+        + (uint64_t)(scroll_ticks_done + 1) * scroll_period;
+      uint64_t now = time_us_64();
+      pico7219_timer_add (&stats.scroll_jitter, 
+        now > due ? now - due : 0);
+#endif
+      scroll_ticks_done = ticks;
+      if (n > SCROLL_MAX_STEP) n = SCROLL_MAX_STEP;
+      scroll_step (n);
+      }
+    }
+
+  // Move a roll transition on, one row at a time
+  if (rolling && !flushing && time_us_64() >= next_roll_time)
+    {
+    // The last step must be flushing before rolling is cleared, so that
+    //  render_is_idle() never sees both clear too soon
+    BOOL more = pico7219_roll_step (pico7219);
+    next_roll_time += ROLL_TIME_US;
+    start_flush ();
+    rolling = more;
+    }
+  }
+
+//
+// render_init
+//
+// Create the Pico7219 object. This must be done on the core that will
+// use it, because the DMA interrupt is enabled on the calling core.
+//
+static void render_init (void)
+  {
+  // Create the Pico7219 object, specifying the connected pins and
+  //  baud rate. The last parameter indicates whether the column order
+  //  should be reversed -- this depends on how the LED matrix is wired
+  //  to the MAX7219, and isn't easy to determine except by trying.
+  // With short wiring, the baud rate could be at least twice what is
+  //  set here, but this probably isn't the limiting factor in 
+  //  throughput.
+  pico7219 = pico7219_create (SPI_CHAN, 2000 * 1000,
+    MOSI, SCK, CS, CHAIN_LEN, FALSE);
+
+  // The module should power on blank, but let's be sure.
+  pico7219_switch_off_all (pico7219, FALSE);
+
+  // Draw in the back buffer, so that updates can be made without
+  //  disturbing scrolling
+  pico7219_set_double_buffered (pico7219, TRUE);
+
+  // The line buffer, for text to be displayed
+  line_buffer = buffer_new (MAX_LINE);
+  }
+
+#if PICO_ON_DEVICE
+//
+// render_wait
+//
+// Sleep until render_task() might have something to do: a command is
+// published, a scroll tick or a flush completion arrives, or the next 
+// roll step is due. Each of those signals an event (__sev()), so one
+// that happens after the checks here still ends the wait at once.
+//
+static void render_wait (void)
+  {
+  if (!cmdqueue_is_empty (cmd_queue)) return;
+  if (!flushing)
+    {
+    if (scrolling && scroll_ticks != scroll_ticks_done) return;
+    if (rolling)
+      {
+      best_effort_wfe_or_timeout (from_us_since_boot (next_roll_time));
+      return;
+      }
+    }
+  __wfe();
+  }
+
+//
+// render_main
+//
+// Entry point for core 1. 
+//
+static void render_main (void)
+  {
+  render_init ();
+  while (TRUE)
+    {
+    render_task ();
+    render_wait ();
+    }
+  }
+#endif
+
+//
+// render_start
+//
+void render_start (CmdQueue *queue)
+  {
+  cmd_queue = queue;
+#if PICO_ON_DEVICE
+  multicore_launch_core1 (render_main);
+#else
+  render_init ();
+#endif
+  }
+
+//
+// render_is_idle
+//
+// See render.h
+//
+BOOL render_is_idle (void)
+  {
+  return !flushing && !rolling;
+  }
+
+#if PICO7219_STATS
+//
+// render_get_stats
+//
+// See render.h
+//
+void render_get_stats (RenderStats *s)
+  {
+  *s = stats_snapshot;
+  }
+#endif
+
@@ -0,0 +1,81 @@
+/*=========================================================================
+ 
+  Pico7219usb
+
+  render.h 
+
+  The display side of the firmware. On the Pico, this runs on core 1,
+  which owns the Pico7219 instance and does all the text rendering, 
+  SPI output and scroll timing. It takes its work from a CmdQueue, 
+  which core 0 fills with commands parsed from the host. So scrolling
+  keeps to time however much data the host is sending, and command
+  handling is never held up by the display.
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#pragma once
+
+#include <pico7219/pico7219.h>
+#include "prog/cmdqueue.h"
+
+typedef struct Pico7219 Pico7219; // Shorter than "struct Pico7219..."
+
+// Counts and timings kept by the renderer, if PICO7219_STATS is set
+typedef struct _RenderStats
+  {
+  struct Pico7219Stats display; // From the display library
+  // Time from the start of each scroll step until it has been sent
+  struct Pico7219Timer scroll_frame; 
+  // How late each automatic scroll step is, compared to the schedule
+  struct Pico7219Timer scroll_jitter;
+  } RenderStats;
+
+// 
+// render_start
+//
+// Start the renderer, taking commands from the given queue. On the Pico
+// this launches core 1, and returns. In a host build there is only one
+// core, so the caller must call render_task() regularly. 
+//
+void render_start (CmdQueue *queue);
+
+// 
+// render_task
+//
+// Carry out any queued commands, and scroll the display if it is time
+// to. This doesn't wait for anything, and returns as soon as there is
+// nothing to do. On the Pico, core 1 calls this in a loop.
+//
+void render_task (void);
+
+//
+// render_text
+//
+// Draw a string of text on a display, in the renderer's font, starting
+// at column x of the virtual chain, which must be long enough to hold 
+// it. Each character is six columns wide. The renderer uses this on 
+// its own display, but it works on any Pico7219 instance, which is how
+// the benchmarks use it.
+//
+void render_text (Pico7219 *display, const char *s, int x);
+
+//
+// render_is_idle
+//
+// Returns TRUE if nothing is being sent to the display, and no roll is
+// in progress. If the command queue is empty as well, the display shows
+// everything it has been sent. This can be called from either core.
+//
+BOOL render_is_idle (void);
+
+#if PICO7219_STATS
+//
+// render_get_stats
+//
+// Get the renderer's counts and timings, as they were when it last
+// carried out a CMD_STATS command. 
+//
+void render_get_stats (RenderStats *stats);
+#endif
+
@@ -0,0 +1,175 @@
+/*=========================================================================
+ 
+  Pico7219usb
+
+  usbrx.c
+
+  Receive ring buffer for data from the host. See usbrx.h for details.
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+
+#include <pico/stdlib.h>
+#include <string.h>
+#if PICO_ON_DEVICE
+#include "pico/stdio_usb.h"
+#include "hardware/sync.h"
+#endif
+#include "prog/usbrx.h"
+
+static uint8_t ring [USBRX_RING_LEN];
+
+// The ring is filled and emptied only on core 0, from the main loop,
+//   never from an interrupt. head is where the next data goes, and tail
+//   is the oldest unread data. Both just count up, and are reduced
+//   modulo the ring length when used.
+static uint32_t head = 0;
+static uint32_t tail = 0;
+
+static volatile uint32_t overflows = 0;
+
+// 
+// usbrx_fill
+//
+// Move as much data as we have room for into the ring. The free space
+// is at most two contiguous spans, so this takes at most two reads. In
+// a host build, if nothing has arrived, wait at most timeout_us for it.
+// On the Pico, the data is read through the SDK's USB stdio driver, 
+// which holds the stdio mutex around its call to tud_cdc_read(), so
+// the read can't interleave with the USB task, or with printf().
+//
+static void usbrx_fill (uint32_t timeout_us)
+  {
+  while (1)
+    {
+    uint32_t h = head;
+    uint32_t space = USBRX_RING_LEN - (h - tail);
+    if (space == 0) break;
+    uint32_t index = h & (USBRX_RING_LEN - 1);
+    uint32_t span = USBRX_RING_LEN - index;
+    if (span > space) span = space;
+#if PICO_ON_DEVICE
+    (void)timeout_us;
+    int n = stdio_usb.in_chars ((char *)ring + index, span);
+#else
+    int n = host_read (ring + index, span, timeout_us);
+    timeout_us = 0;
+#endif
+    if (n <= 0) break;
+    head = h + n;
+    }
+  }
+
+#if PICO_ON_DEVICE
+// 
+// usbrx_chars_available
+//
+// Called by the Pico SDK, from the USB interrupt, when there is data in 
+// the CDC receive FIFO. All this does is wake core 0, if it's waiting
+// in usbrx_wait(); the data is read from there. The SDK calls this 
+// only when new data arrives, so data that was left in the FIFO 
+// because the ring was full is picked up when the ring next runs dry.
+//
+static void usbrx_chars_available (void *param)
+  {
+  (void)param;
+  __sev();
+  }
+#endif
+
+// 
+// usbrx_init
+//
+void usbrx_init (void)
+  {
+  head = tail = 0;
+#if PICO_ON_DEVICE
+  stdio_set_chars_available_callback (usbrx_chars_available, NULL);
+#endif
+  }
+
+// 
+// usbrx_peek
+//
+int usbrx_peek (const uint8_t **span)
+  {
+  if (head == tail) usbrx_fill (0);
+  uint32_t t = tail;
+  uint32_t available = head - t;
+  uint32_t index = t & (USBRX_RING_LEN - 1);
+  if (available > USBRX_RING_LEN - index) 
+    available = USBRX_RING_LEN - index;
+  *span = ring + index;
+  return available;
+  }
+
+// 
+// usbrx_wait
+//
+BOOL usbrx_wait (uint32_t timeout_us)
+  {
+#if PICO_ON_DEVICE
+  // The USB interrupt's callback ends the wait. If data arrived 
+  //  between the last fill and the wait, the event it signalled is
+  //  still set, and the wait returns at once.
+  absolute_time_t until = make_timeout_time_us (timeout_us);
+  while (1)
+    {
+    if (head == tail) usbrx_fill (0);
+    if (head != tail) return TRUE;
+    if (best_effort_wfe_or_timeout (until)) return FALSE;
+    }
+#else
+  if (head == tail) usbrx_fill (timeout_us);
+  return head != tail;
+#endif
+  }
+
+// 
+// usbrx_consume
+//
+void usbrx_consume (int n)
+  {
+  tail = tail + n;
+  }
+
+// 
+// usbrx_read
+//
+int usbrx_read (uint8_t *buf, int len, uint32_t timeout_us)
+  {
+  int done = 0;
+  while (done < len)
+    {
+    const uint8_t *span;
+    int n = usbrx_peek (&span);
+    if (n == 0)
+      {
+      if (!usbrx_wait (timeout_us)) break;
+      continue;
+      }
+    if (n > len - done) n = len - done;
+    memcpy (buf + done, span, n);
+    usbrx_consume (n);
+    done += n;
+    }
+  return done;
+  }
+
+// 
+// usbrx_count_overflow
+//
+void usbrx_count_overflow (int n)
+  {
+  overflows += n;
+  }
+
+// 
+// usbrx_get_overflows
+//
+uint32_t usbrx_get_overflows (void)
+  {
+  return overflows;
+  }
+
@@ -0,0 +1,88 @@
+/*=========================================================================
+ 
+  Pico7219usb
+
+  usbrx.h 
+
+  A ring buffer for data received from the host. On the Pico, the ring
+  is filled from the TinyUSB CDC receive FIFO, in chunks, by core 0,
+  whenever the ring runs dry. The callback that the Pico SDK calls from
+  its USB interrupt when data arrives only wakes core 0 up. The command
+  parser then works on whole contiguous spans of the ring, rather than
+  a character at a time.
+
+  If the ring is full, data is left in the TinyUSB FIFO, and the host
+  is held off by USB flow control, so nothing is lost at this stage.
+  Data can still be lost if a command line is too long for the input
+  buffer; the parser reports the number of bytes dropped in this way
+  using usbrx_count_overflow().
+
+  In a host build, there is no TinyUSB, and the ring is filled from
+  stdin (or a pseudo-terminal), in chunks, using host_read().
+
+  (c)2021 Kevin Boone, GPL v3.0
+
+  =========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include <pico7219/pico7219.h>
+
+// Size of the ring. Must be a power of two.
+#define USBRX_RING_LEN 1024 
+
+// 
+// usbrx_init
+//
+// Set up the ring, and start receiving data. Call after stdio_init_all().
+//
+void usbrx_init (void);
+
+// 
+// usbrx_peek
+//
+// Set *span to point to the oldest unread data in the ring, and return
+// the number of bytes that can be read from there in one go, which may
+// be zero. The data stays in the ring until usbrx_consume() is called.
+//
+int usbrx_peek (const uint8_t **span);
+
+// 
+// usbrx_wait
+//
+// If there's no unread data, wait for some to arrive, for at most
+// timeout_us. Returns FALSE if there still isn't any. On the Pico, the
+// core sleeps while it waits, until the USB interrupt wakes it up.
+//
+BOOL usbrx_wait (uint32_t timeout_us);
+
+// 
+// usbrx_consume
+//
+// Discard the first n bytes of unread data.
+//
+void usbrx_consume (int n);
+
+// 
+// usbrx_read
+//
+// Read len bytes into buf, waiting for them to arrive if necessary. If
+// no data arrives for timeout_us, give up. Returns the number of bytes
+// read.
+//
+int usbrx_read (uint8_t *buf, int len, uint32_t timeout_us);
+
+// 
+// usbrx_count_overflow
+//
+// Record that n bytes of input have been dropped.
+//
+void usbrx_count_overflow (int n);
+
+// 
+// usbrx_get_overflows
+//
+// Get the total number of bytes of input that have been dropped.
+//
+uint32_t usbrx_get_overflows (void);
+
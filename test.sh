@@ -1,4 +1,4 @@
-DEV=/dev/ttyACM0
+DEV=${PICO7219_DEV:-/dev/ttyACM0}
 
 function send_and_receive ()
   {
@@ -9,8 +9,8 @@ function send_and_receive ()
 
 # Enable hardware flow control and disable echo. These 
 #  settings are essential for reliable communication. 
-stty -F /dev/ttyACM0 speed 115200 > /dev/null
-stty -F /dev/ttyACM0 crtscts -icanon -iexten -echo
+stty -F $DEV speed 115200 > /dev/null
+stty -F $DEV crtscts -icanon -iexten -echo
 
 # Reset the display
 send_and_receive "R"